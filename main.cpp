@@ -1,10 +1,28 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <functional>
+#include <algorithm>
+#include <sstream>
+#include <mutex>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <random>
+#include <cmath>
+#include <csignal>
 #include <fstream>
 #include <curl/curl.h>
 #include <libxml/HTMLparser.h>
+#include <libxml/parserInternals.h>
 #include <libxml/xpath.h>
+#include <libxml/uri.h>
 #include <cstring>
 #include <cstdlib>
 #include <jsoncpp/json/json.h>
@@ -13,6 +31,23 @@
 #include <iomanip>
 #include <mysql/mysql.h> // MariaDB/MySQL C API
 #include <sys/stat.h>    // <--- добавьте эту строку
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define HAVE_ZSTD 1 // сжатие архива статей (libzstd-dev, -lzstd)
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h> // SSE2/AVX2 в normalize_text
+#endif
 
 using std::regex;
 using std::smatch;
@@ -20,653 +55,5334 @@ using std::sregex_iterator;
 
 using namespace std;
 
-// Функция для получения текущего времени в формате [HH:MM:SS]
-string get_current_time()
-{
-    time_t now = time(nullptr);
-    tm *ltm = localtime(&now);
-    stringstream ss;
-    ss << "[" << setw(2) << setfill('0') << ltm->tm_hour << ":"
-       << setw(2) << setfill('0') << ltm->tm_min << ":"
-       << setw(2) << setfill('0') << ltm->tm_sec << "]";
-    return ss.str();
-}
-
-class HtmlParser
+// --- Ограниченная очередь (журнал, стадии конвейера) ---
+// Кольцевой MPMC-буфер без блокировок (схема Д. Вьюкова). Мьютекс и condition_variable
+// нужны только чтобы уснуть, когда очередь пуста или заполнена, — так ограниченный
+// размер даёт обратное давление на пишущих.
+template <typename T>
+class BoundedQueue
 {
 private:
-    string html_content;
-    htmlDocPtr doc;
-    friend vector<string> find_article_links(HtmlParser &, const string &);
+    struct Cell
+    {
+        atomic<size_t> seq;
+        T value;
+    };
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0}; // следующая позиция записи
+    alignas(64) atomic<size_t> tail{0}; // следующая позиция чтения
+    atomic<bool> closed{false};
+    atomic<int> waiters{0};
+    mutex mtx;
+    condition_variable cv;
 
-public:
-    HtmlParser(const string &html) : html_content(html), doc(nullptr)
+    bool try_push(T &value)
     {
-        doc = htmlReadDoc((const xmlChar *)html_content.c_str(),
-                          NULL, NULL,
-                          HTML_PARSE_RECOVER |
-                              HTML_PARSE_NOERROR |
-                              HTML_PARSE_NOWARNING);
+        size_t pos = head.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            intptr_t diff = (intptr_t)cell.seq.load(memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0 && head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                cell.value = move(value);
+                cell.seq.store(pos + 1, memory_order_release);
+                return true;
+            }
+            if (diff < 0)
+                return false; // заполнена
+            if (diff > 0)
+                pos = head.load(memory_order_relaxed);
+        }
+    }
 
-        // Добавьте проверку
-        if (!doc)
+    bool try_pop(T &value)
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        while (true)
         {
-            cerr << "Failed to parse HTML document" << endl;
-            ofstream bad_html("bad_html.html");
-            bad_html << html_content;
-            bad_html.close();
+            Cell &cell = cells[pos & mask];
+            intptr_t diff = (intptr_t)cell.seq.load(memory_order_acquire) - (intptr_t)(pos + 1);
+            if (diff == 0 && tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                value = move(cell.value);
+                cell.seq.store(pos + mask + 1, memory_order_release);
+                return true;
+            }
+            if (diff < 0)
+                return false; // пуста
+            if (diff > 0)
+                pos = tail.load(memory_order_relaxed);
         }
     }
-    ~HtmlParser()
+
+    void wake()
     {
-        if (doc)
+        atomic_thread_fence(memory_order_seq_cst);
+        if (waiters.load(memory_order_relaxed))
         {
-            xmlFreeDoc(doc);
-            cout << get_current_time() << " HTML parser resources freed" << endl;
+            lock_guard<mutex> lock(mtx);
+            cv.notify_all();
         }
     }
 
-    bool is_valid() const
+    // Засыпает, пока ready() не станет истинным; таймаут страхует от пропущенного пробуждения
+    template <typename Ready>
+    void sleep_until(Ready ready)
     {
-        return doc != nullptr;
+        waiters.fetch_add(1);
+        atomic_thread_fence(memory_order_seq_cst);
+        unique_lock<mutex> lock(mtx);
+        cv.wait_for(lock, chrono::milliseconds(100), ready);
+        waiters.fetch_sub(1);
     }
 
-    vector<string> find_by_class(const string &class_name)
+public:
+    explicit BoundedQueue(size_t capacity)
     {
-        vector<string> results;
-        if (!doc)
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i)
+            cells[i].seq.store(i, memory_order_relaxed);
+    }
+
+    // Ждёт свободного места; false, если очередь закрыта
+    bool push(T value)
+    {
+        while (!closed.load())
         {
-            cerr << get_current_time() << " ERROR: No valid document for class search" << endl;
-            return results;
+            if (try_push(value))
+            {
+                wake();
+                return true;
+            }
+            sleep_until([this]
+                        { return closed.load() || (intptr_t)(head.load() - tail.load()) <= (intptr_t)mask; });
         }
+        return false;
+    }
 
-        cout << get_current_time() << " Searching for elements with class: " << class_name << endl;
-        xmlXPathContextPtr context = xmlXPathNewContext(doc);
-        if (!context)
+    // Ждёт элемента; false, если очередь закрыта и опустела
+    bool pop(T &value)
+    {
+        while (true)
         {
-            cerr << get_current_time() << " ERROR: Failed to create XPath context" << endl;
-            return results;
+            if (try_pop(value))
+            {
+                wake();
+                return true;
+            }
+            if (closed.load() && empty())
+                return false;
+            sleep_until([this]
+                        { return closed.load() || !empty(); });
         }
+    }
+
+    // Не ждёт; false, если очередь пуста
+    bool try_pop_now(T &value)
+    {
+        if (!try_pop(value))
+            return false;
+        wake();
+        return true;
+    }
 
-        string xpath = "//*[contains(@class, '" + class_name + "')]";
-        xmlXPathObjectPtr result = xmlXPathEvalExpression((const xmlChar *)xpath.c_str(), context);
+    bool empty() const
+    {
+        return head.load() == tail.load();
+    }
 
-        if (result && result->nodesetval)
+    void close()
+    {
+        closed.store(true);
+        lock_guard<mutex> lock(mtx);
+        cv.notify_all();
+    }
+};
+
+// --- Асинхронный журнал с уровнями ---
+// Строка собирается в вызывающем потоке, только если её уровень включён, и уходит в очередь.
+// Фоновый поток дописывает метку времени (пересчитывается раз в секунду), выводит
+// накопившиеся строки и сбрасывает буферы один раз на пачку, а не на каждую строку.
+enum class LogLevel
+{
+    Debug,
+    Info,
+    Warning,
+    Error
+};
+
+struct LogRecord
+{
+    LogLevel level = LogLevel::Info;
+    time_t time = 0;
+    string text;
+};
+
+class Logger
+{
+private:
+    atomic<int> min_level{(int)LogLevel::Info};
+    BoundedQueue<LogRecord> queue{8192};
+    thread writer;
+
+    void drain()
+    {
+        static const char *const prefixes[] = {"DEBUG: ", "", "WARNING: ", "ERROR: "};
+        time_t stamp_time = -1;
+        char stamp[16] = "";
+        LogRecord record;
+        while (queue.pop(record))
         {
-            cout << get_current_time() << " Found " << result->nodesetval->nodeNr << " elements" << endl;
-            for (int i = 0; i < result->nodesetval->nodeNr; ++i)
+            do
             {
-                xmlNodePtr node = result->nodesetval->nodeTab[i];
-                xmlChar *content = xmlNodeGetContent(node);
-                if (content)
+                if (record.time != stamp_time)
                 {
-                    results.push_back(string((char *)content));
-                    xmlFree(content);
+                    tm ltm;
+                    localtime_r(&record.time, &ltm);
+                    strftime(stamp, sizeof(stamp), "[%H:%M:%S] ", &ltm);
+                    stamp_time = record.time;
                 }
+                // Предупреждения и ошибки, как и раньше, идут в stderr
+                FILE *out = record.level >= LogLevel::Warning ? stderr : stdout;
+                fputs(stamp, out);
+                fputs(prefixes[(int)record.level], out);
+                fwrite(record.text.data(), 1, record.text.size(), out);
+                fputc('\n', out);
+            } while (queue.try_pop_now(record));
+            fflush(stdout);
+            fflush(stderr);
+            // Пока поток спит, пишущие не тратят время на его пробуждение, а строки копятся в пачку
+            this_thread::sleep_for(chrono::milliseconds(20));
+        }
+    }
+
+public:
+    Logger() : writer(&Logger::drain, this) {}
+    // Дописывает всё, что осталось в очереди
+    ~Logger()
+    {
+        queue.close();
+        writer.join();
+    }
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    bool enabled(LogLevel level) const
+    {
+        return (int)level >= min_level.load(memory_order_relaxed);
+    }
+    void set_level(LogLevel level)
+    {
+        min_level.store((int)level, memory_order_relaxed);
+    }
+    void write(LogLevel level, string text)
+    {
+        queue.push(LogRecord{level, time(nullptr), move(text)});
+    }
+
+    // "debug", "info", "warning", "error"
+    static LogLevel parse_level(const string &name)
+    {
+        if (name == "debug")
+            return LogLevel::Debug;
+        if (name == "warning")
+            return LogLevel::Warning;
+        if (name == "error")
+            return LogLevel::Error;
+        if (name != "info")
+            throw runtime_error("Unknown log_level: " + name);
+        return LogLevel::Info;
+    }
+};
+
+Logger logger;
+
+// Одна строка журнала; отправляется в очередь в деструкторе
+class LogLine
+{
+private:
+    LogLevel level;
+    ostringstream text;
+
+public:
+    explicit LogLine(LogLevel level) : level(level) {}
+    ~LogLine()
+    {
+        logger.write(level, text.str());
+    }
+
+    template <typename T>
+    LogLine &operator<<(const T &value)
+    {
+        text << value;
+        return *this;
+    }
+};
+
+// Превращает выражение LogLine << ... в void для тернарного оператора в LOG
+struct LogVoidify
+{
+    void operator&(const LogLine &) {}
+};
+
+// LOG(Info) << "..."; при выключенном уровне аргументы не вычисляются.
+// Тернарный оператор вместо if, чтобы макрос был безопасен внутри if/else без скобок
+#define LOG(level) \
+    !logger.enabled(LogLevel::level) ? (void)0 : LogVoidify() & LogLine(LogLevel::level)
+
+// --- Метрики: гистограммы и счётчики по стадиям ---
+// Запись — пара атомарных инкрементов без блокировок. Мьютекс реестра нужен только для поиска
+// метрики по имени и меткам, поэтому часто вызываемый код держит ссылку на свою метрику.
+using MetricLabels = vector<pair<string, string>>;
+
+// Гистограмма с логарифмическими бакетами: в бакет i попадают значения меньше 2^i.
+// Время хранится в микросекундах, размеры — в байтах; unit переводит значения при выводе.
+class Histogram
+{
+public:
+    static const int BUCKETS = 32; // последний бакет — всё, что больше 2^30
+
+    explicit Histogram(double unit) : unit(unit) {}
+
+    void observe(uint64_t value)
+    {
+        int i = value ? 64 - __builtin_clzll(value) : 0;
+        buckets[min(i, BUCKETS - 1)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(value, memory_order_relaxed);
+    }
+    void observe(chrono::steady_clock::duration elapsed)
+    {
+        observe((uint64_t)max<int64_t>(0, chrono::duration_cast<chrono::microseconds>(elapsed).count()));
+    }
+
+    const double unit;
+    atomic<uint64_t> buckets[BUCKETS] = {};
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> sum{0};
+};
+
+// Замеряет время жизни объекта
+class ScopedTimer
+{
+private:
+    Histogram &histogram;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+public:
+    explicit ScopedTimer(Histogram &histogram) : histogram(histogram) {}
+    ~ScopedTimer()
+    {
+        histogram.observe(chrono::steady_clock::now() - start);
+    }
+};
+
+class Metrics
+{
+private:
+    using Key = pair<string, MetricLabels>;
+    mutex mtx;
+    map<Key, unique_ptr<Histogram>> histograms;
+    map<Key, unique_ptr<atomic<uint64_t>>> counters;
+
+    static string format_labels(const MetricLabels &labels, const string &extra = "")
+    {
+        string out;
+        for (const auto &[name, value] : labels)
+        {
+            out += (out.empty() ? "" : ",") + name + "=\"";
+            for (char c : value)
+            {
+                if (c == '\\' || c == '"')
+                    out += '\\';
+                out += c == '\n' ? ' ' : c;
             }
+            out += '"';
         }
-        else
+        if (!extra.empty())
+            out += (out.empty() ? "" : ",") + extra;
+        return out.empty() ? "" : "{" + out + "}";
+    }
+
+    static Json::Value labels_json(const MetricLabels &labels)
+    {
+        Json::Value out(Json::objectValue);
+        for (const auto &[name, value] : labels)
+            out[name] = value;
+        return out;
+    }
+
+    // Оценка квантиля по верхней границе бакета
+    static double quantile(const Histogram &h, double q)
+    {
+        uint64_t total = h.total.load(memory_order_relaxed);
+        uint64_t rank = (uint64_t)ceil(q * total), seen = 0;
+        for (int i = 0; i < Histogram::BUCKETS; ++i)
         {
-            cout << get_current_time() << " No elements found with class: " << class_name << endl;
+            seen += h.buckets[i].load(memory_order_relaxed);
+            if (total && seen >= rank)
+                return ldexp(1.0, i) * h.unit;
         }
+        return 0;
+    }
 
-        xmlXPathFreeObject(result);
-        xmlXPathFreeContext(context);
-        return results;
+public:
+    // unit: 1e-6 для времени в микросекундах (выводится в секундах), 1 для байтов
+    Histogram &histogram(const string &name, const MetricLabels &labels = {}, double unit = 1e-6)
+    {
+        lock_guard<mutex> lock(mtx);
+        unique_ptr<Histogram> &h = histograms[{name, labels}];
+        if (!h)
+            h = make_unique<Histogram>(unit);
+        return *h;
     }
 
-    vector<string> find_by_selector(const string &selector)
+    atomic<uint64_t> &counter(const string &name, const MetricLabels &labels = {})
     {
-        vector<string> results;
-        if (!doc)
+        lock_guard<mutex> lock(mtx);
+        unique_ptr<atomic<uint64_t>> &c = counters[{name, labels}];
+        if (!c)
+            c = make_unique<atomic<uint64_t>>(0);
+        return *c;
+    }
+
+    // Текстовый формат Prometheus
+    string prometheus()
+    {
+        lock_guard<mutex> lock(mtx);
+        ostringstream out;
+        string last;
+        for (const auto &[key, c] : counters)
         {
-            cerr << get_current_time() << " ERROR: No valid document for selector search" << endl;
-            return results;
+            if (key.first != last)
+                out << "# TYPE " << (last = key.first) << " counter\n";
+            out << key.first << format_labels(key.second) << " " << c->load(memory_order_relaxed) << "\n";
+        }
+        for (const auto &[key, h] : histograms)
+        {
+            if (key.first != last)
+                out << "# TYPE " << (last = key.first) << " histogram\n";
+            uint64_t cumulative = 0;
+            for (int i = 0; i < Histogram::BUCKETS; ++i)
+            {
+                uint64_t n = h->buckets[i].load(memory_order_relaxed);
+                cumulative += n;
+                // Пустые бакеты не выводятся: для кумулятивных значений это ничего не меняет
+                if (n == 0 || i == Histogram::BUCKETS - 1)
+                    continue;
+                ostringstream le;
+                le << "le=\"" << ldexp(1.0, i) * h->unit << "\"";
+                out << key.first << "_bucket" << format_labels(key.second, le.str()) << " " << cumulative << "\n";
+            }
+            out << key.first << "_bucket" << format_labels(key.second, "le=\"+Inf\"") << " " << cumulative << "\n";
+            out << key.first << "_sum" << format_labels(key.second) << " " << h->sum.load(memory_order_relaxed) * h->unit << "\n";
+            out << key.first << "_count" << format_labels(key.second) << " " << h->total.load(memory_order_relaxed) << "\n";
         }
+        return out.str();
+    }
 
-        cout << get_current_time() << " Searching with selector: " << selector << endl;
-        xmlXPathContextPtr context = xmlXPathNewContext(doc);
-        if (!context)
+    // Сводка для metrics.json: число замеров, сумма и оценки p50/p90/p99
+    Json::Value json()
+    {
+        lock_guard<mutex> lock(mtx);
+        Json::Value out(Json::objectValue);
+        out["counters"] = Json::Value(Json::arrayValue);
+        out["histograms"] = Json::Value(Json::arrayValue);
+        for (const auto &[key, c] : counters)
         {
-            cerr << get_current_time() << " ERROR: Failed to create XPath context" << endl;
-            return results;
+            Json::Value entry;
+            entry["name"] = key.first;
+            entry["labels"] = labels_json(key.second);
+            entry["value"] = (Json::UInt64)c->load(memory_order_relaxed);
+            out["counters"].append(entry);
+        }
+        for (const auto &[key, h] : histograms)
+        {
+            Json::Value entry;
+            entry["name"] = key.first;
+            entry["labels"] = labels_json(key.second);
+            entry["count"] = (Json::UInt64)h->total.load(memory_order_relaxed);
+            entry["sum"] = h->sum.load(memory_order_relaxed) * h->unit;
+            entry["p50"] = quantile(*h, 0.5);
+            entry["p90"] = quantile(*h, 0.9);
+            entry["p99"] = quantile(*h, 0.99);
+            out["histograms"].append(entry);
         }
+        return out;
+    }
+};
 
-        xmlXPathObjectPtr result = xmlXPathEvalExpression((const xmlChar *)selector.c_str(), context);
+Metrics metrics;
 
-        if (result && result->nodesetval)
+const int HTML_PARSE_FLAGS = HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING;
+
+// --- Скомпилированное XPath-выражение ---
+// Компилируется один раз и затем вычисляется для любого числа документов.
+class CompiledXPath
+{
+private:
+    string source;
+    xmlXPathCompExprPtr comp;
+
+public:
+    Histogram &eval_time; // время вычисления этого выражения по всем документам
+
+    explicit CompiledXPath(const string &expr)
+        : source(expr), comp(xmlXPathCompile((const xmlChar *)expr.c_str())),
+          eval_time(metrics.histogram("parser_xpath_eval_seconds", {{"xpath", expr}}))
+    {
+        if (!comp)
+            throw runtime_error("Invalid XPath expression: " + expr);
+    }
+    ~CompiledXPath()
+    {
+        xmlXPathFreeCompExpr(comp);
+    }
+    CompiledXPath(const CompiledXPath &) = delete;
+    CompiledXPath &operator=(const CompiledXPath &) = delete;
+
+    const string &expr() const { return source; }
+    xmlXPathCompExprPtr get() const { return comp; }
+
+    // Общий для процесса кэш: одинаковые выражения компилируются один раз
+    static shared_ptr<const CompiledXPath> compile(const string &expr)
+    {
+        static mutex mtx;
+        static map<string, shared_ptr<const CompiledXPath>> cache;
+        lock_guard<mutex> lock(mtx);
+        shared_ptr<const CompiledXPath> &entry = cache[expr];
+        if (!entry)
+            entry = make_shared<const CompiledXPath>(expr);
+        return entry;
+    }
+};
+
+// --- Набор регулярных выражений с литеральным префильтром ---
+// Выражения компилируются один раз. Для каждого заранее извлекается литерал, который
+// обязан встретиться в совпадении: строки без него отсеиваются дешёвым поиском подстроки,
+// и медленный std::regex запускается только для оставшихся.
+class RegexSet
+{
+private:
+    struct Pattern
+    {
+        string source;
+        string literal; // обязательная подстрока, пустая если выделить не удалось
+        regex re;
+    };
+    vector<Pattern> patterns;
+
+public:
+    // Самая длинная последовательность обычных символов вне групп и классов, которая
+    // обязательно входит в любое совпадение. При альтернативе '|' гарантий нет.
+    // Ошибка здесь — ложный отказ matches(), поэтому всё сомнительное обрывает литерал.
+    static string required_literal(const string &pattern)
+    {
+        string best, run;
+        auto flush = [&]()
         {
-            cout << get_current_time() << " Found " << result->nodesetval->nodeNr << " elements" << endl;
-            for (int i = 0; i < result->nodesetval->nodeNr; ++i)
+            if (run.size() > best.size())
+                best = run;
+            run.clear();
+        };
+        int depth = 0;
+        for (size_t i = 0; i < pattern.size(); ++i)
+        {
+            char c = pattern[i];
+            if (c == '|')
+                return "";
+            if (c == '\\' && i + 1 < pattern.size())
             {
-                xmlNodePtr node = result->nodesetval->nodeTab[i];
-                xmlChar *content = xmlNodeGetContent(node);
-                if (content)
+                char next = pattern[++i];
+                if (depth == 0 && !isalnum((unsigned char)next))
                 {
-                    results.push_back(string((char *)content));
-                    xmlFree(content);
+                    run += next; // экранированный знак препинания — обычный символ
+                    continue;
                 }
+                flush(); // \d, \w, \b и т.п.
+                // Аргументы \xHH, \uHHHH, \cX и номера обратных ссылок — не литералы
+                size_t argument = next == 'x' ? 2 : next == 'u' ? 4 : next == 'c' ? 1 : 0;
+                if (isdigit((unsigned char)next))
+                    argument = strspn(pattern.c_str() + i + 1, "0123456789");
+                i = min(i + argument, pattern.size() - 1);
+            }
+            else if (c == '[')
+            {
+                flush();
+                while (i + 1 < pattern.size() && pattern[++i] != ']')
+                {
+                    if (pattern[i] == '\\')
+                        ++i;
+                }
+            }
+            else if (c == '(')
+            {
+                flush();
+                depth++;
+            }
+            else if (c == ')')
+            {
+                depth = max(0, depth - 1);
+            }
+            else if (c == '?' || c == '*' || c == '{')
+            {
+                if (!run.empty())
+                    run.pop_back(); // предыдущий символ необязателен или повторяется
+                flush();
+                if (c == '{') // тело интервала {m,n} — не текст
+                {
+                    while (i + 1 < pattern.size() && pattern[++i] != '}')
+                        ;
+                }
+            }
+            else if (c == '+' || c == '.' || c == '^' || c == '$')
+            {
+                flush();
+            }
+            else if (depth == 0)
+            {
+                run += c;
             }
         }
-        else
-        {
-            cout << get_current_time() << " No elements found with selector: " << selector << endl;
-        }
-
-        xmlXPathFreeObject(result);
-        xmlXPathFreeContext(context);
-        return results;
+        flush();
+        return best;
     }
 
-    vector<string> find_by_regex(const string &pattern)
+    RegexSet() = default;
+    explicit RegexSet(const vector<string> &sources)
     {
-        vector<string> results;
-        if (!doc)
+        for (const string &source : sources)
         {
-            cerr << get_current_time() << " ERROR: No valid document for regex search" << endl;
-            return results;
+            try
+            {
+                patterns.push_back({source, required_literal(source), regex(source, regex::optimize)});
+            }
+            catch (const regex_error &e)
+            {
+                throw runtime_error("Invalid regex '" + source + "': " + e.what());
+            }
         }
+    }
 
-        cout << get_current_time() << " Searching with regex pattern: " << pattern << endl;
-        regex re(pattern);
-        smatch matches;
-        string content = html_content;
+    bool empty() const { return patterns.empty(); }
 
-        sregex_iterator it(content.begin(), content.end(), re);
-        sregex_iterator end;
+    // false, если text подходит под выражение, но не содержит его литерал, — matches()
+    // отверг бы подходящий адрес. Проверяется в --bench
+    bool prefilter_agrees(const string &text) const
+    {
+        for (const Pattern &p : patterns)
+        {
+            if (text.find(p.literal) == string::npos && regex_search(text, p.re))
+                return false;
+        }
+        return true;
+    }
 
-        int count = 0;
-        for (; it != end; ++it)
+    // То же, что matches(), но без предфильтра — эталон для --bench
+    bool matches_unfiltered(const string &text) const
+    {
+        for (const Pattern &p : patterns)
         {
-            results.push_back(it->str());
-            count++;
+            if (regex_search(text, p.re))
+                return true;
         }
+        return false;
+    }
 
-        cout << get_current_time() << " Found " << count << " regex matches" << endl;
-        return results;
+    // true, если text подходит хотя бы под одно выражение
+    bool matches(const string &text) const
+    {
+        for (const Pattern &p : patterns)
+        {
+            if (!p.literal.empty() && text.find(p.literal) == string::npos)
+                continue;
+            if (regex_search(text, p.re))
+                return true;
+        }
+        return false;
     }
 
-    string get_element_content(const string &xpath)
+    // Общий для процесса кэш одиночных выражений (для find_by_regex)
+    static shared_ptr<const regex> compile(const string &pattern)
     {
-        if (!doc)
-            return "";
+        static mutex mtx;
+        static map<string, shared_ptr<const regex>> cache;
+        lock_guard<mutex> lock(mtx);
+        shared_ptr<const regex> &entry = cache[pattern];
+        if (!entry)
+            entry = make_shared<const regex>(pattern, regex::optimize);
+        return entry;
+    }
+};
 
-        xmlXPathContextPtr context = xmlXPathNewContext(doc);
-        if (!context)
-            return "";
+// --- Пул контекстов потокового разбора HTML ---
+// Контекст libxml2 (стеки разбора, входной буфер, таблица SAX) создаётся один раз и после
+// каждого документа сбрасывается htmlCtxtReset. По умолчанию HTML-парсер копирует имя каждого
+// узла отдельно; здесь имена берутся из словаря. Имена тегов и атрибутов хоста собираются
+// в словарь по первому разобранному документу и дальше не меняются: словарь каждого
+// следующего документа надстраивается над ним (xmlDictCreateSub) и хранит только новые
+// строки. Документ владеет своим подсловарём, поэтому его можно освобождать в другом потоке.
+// Короткий текст хранится прямо в узле (HTML_PARSE_COMPACT), поэтому документы только читаются.
+// Содержимое <script> и <style> при разборе отбрасывается. Пул однопоточный: свой у каждого Fetcher.
+class HtmlParserPool
+{
+private:
+    vector<htmlParserCtxtPtr> idle;
+    map<string, xmlDictPtr> host_dicts; // только чтение после заполнения
 
-        // Добавим проверку выражения
-        if (xpath.empty())
+    static void skip_script(void *, const xmlChar *, int) {}
+
+    // Переводит контекст на новый словарь; строки xml/xmlns контекст держит из своего словаря
+    static void set_dict(htmlParserCtxtPtr ctxt, xmlDictPtr dict)
+    {
+        xmlDictFree(ctxt->dict);
+        ctxt->dict = dict;
+        ctxt->str_xml = xmlDictLookup(dict, BAD_CAST "xml", 3);
+        ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST "xmlns", 5);
+        ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+    }
+
+    // Словарь хоста из имён элементов и атрибутов готового документа
+    static xmlDictPtr collect_names(htmlDocPtr doc)
+    {
+        xmlDictPtr dict = xmlDictCreate();
+        xmlNodePtr cur = xmlDocGetRootElement(doc);
+        while (cur)
         {
-            cerr << "XPath expression is empty!" << endl;
-            return "";
+            if (cur->type == XML_ELEMENT_NODE)
+            {
+                xmlDictLookup(dict, cur->name, -1);
+                for (xmlAttrPtr attr = cur->properties; attr; attr = attr->next)
+                    xmlDictLookup(dict, attr->name, -1);
+                if (cur->children)
+                {
+                    cur = cur->children;
+                    continue;
+                }
+            }
+            while (cur && !cur->next)
+                cur = cur->parent;
+            if (cur)
+                cur = cur->next;
         }
+        return dict;
+    }
+
+public:
+    HtmlParserPool() = default;
+    HtmlParserPool(const HtmlParserPool &) = delete;
+    HtmlParserPool &operator=(const HtmlParserPool &) = delete;
+
+    ~HtmlParserPool()
+    {
+        for (htmlParserCtxtPtr ctxt : idle)
+            htmlFreeParserCtxt(ctxt);
+        for (auto &entry : host_dicts)
+            xmlDictFree(entry.second);
+    }
+
+    // Контекст, готовый принимать htmlParseChunk для нового документа
+    htmlParserCtxtPtr acquire(const string &host)
+    {
+        htmlParserCtxtPtr ctxt;
+        if (!idle.empty())
+        {
+            ctxt = idle.back();
+            idle.pop_back();
+            xmlParserInputBufferPtr buffer = xmlAllocParserInputBuffer(XML_CHAR_ENCODING_NONE);
+            xmlParserInputPtr input = buffer ? xmlNewIOInputStream(ctxt, buffer, XML_CHAR_ENCODING_NONE) : nullptr;
+            if (!input)
+            {
+                if (buffer)
+                    xmlFreeParserInputBuffer(buffer);
+                htmlFreeParserCtxt(ctxt);
+                return nullptr;
+            }
+            inputPush(ctxt, input);
+        }
+        else
+        {
+            ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL, XML_CHAR_ENCODING_NONE);
+            if (!ctxt)
+                return nullptr;
+            ctxt->sax->cdataBlock = skip_script;
+        }
+        htmlCtxtUseOptions(ctxt, HTML_PARSE_FLAGS | HTML_PARSE_COMPACT);
+        ctxt->dictNames = 1;
+        ctxt->progressive = 1;
+
+        auto it = host_dicts.find(host);
+        set_dict(ctxt, it != host_dicts.end() ? xmlDictCreateSub(it->second) : xmlDictCreate());
+        return ctxt;
+    }
+
+    // Возвращает контекст после разбора; doc уже отсоединён от контекста и может быть nullptr
+    void release(htmlParserCtxtPtr ctxt, const string &host, htmlDocPtr doc)
+    {
+        if (doc && !host_dicts.count(host))
+            host_dicts[host] = collect_names(doc);
+        htmlCtxtReset(ctxt);
+        idle.push_back(ctxt);
+    }
+};
+
+class HtmlParser
+{
+private:
+    string html_content; // исходный HTML; в потоковом режиме хранится только при keep_raw
+    htmlDocPtr doc;
+    htmlParserCtxtPtr push_ctxt = nullptr;
+    HtmlParserPool *pool = nullptr; // откуда брать контекст потокового разбора; nullptr — свой
+    string host;                    // чей словарь имён использовать из пула
+    xmlXPathContextPtr xpath_ctx = nullptr; // один контекст на документ для всех запросов
+    bool keep_raw = true;
+    string text_buffer; // буфер extract_text, переиспользуется между вызовами
+    chrono::steady_clock::duration parse_time{}; // потоковый режим: суммарное время в htmlParseChunk
+
+    // Дописывает в out текст всех текстовых потомков node за один обход, без промежуточных строк
+    static void append_node_text(xmlNodePtr node, string &out)
+    {
+        if (node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE)
+        {
+            if (node->content)
+                out.append((const char *)node->content);
+            return;
+        }
+        xmlNodePtr root = node;
+        xmlNodePtr cur = node->children;
+        while (cur)
+        {
+            if ((cur->type == XML_TEXT_NODE || cur->type == XML_CDATA_SECTION_NODE) && cur->content)
+                out.append((const char *)cur->content);
+
+            if (cur->children && cur->type != XML_ENTITY_REF_NODE)
+            {
+                cur = cur->children;
+                continue;
+            }
+            while (cur && cur != root && !cur->next)
+                cur = cur->parent;
+            if (!cur || cur == root)
+                break;
+            cur = cur->next;
+        }
+    }
+
+    void report_failure()
+    {
+        LOG(Error) << "Failed to parse HTML document";
+        if (!html_content.empty())
+        {
+            ofstream bad_html("bad_html.html");
+            bad_html << html_content;
+            bad_html.close();
+        }
+    }
+
+public:
+    // Метка потокового конструктора: с ведущим bool строковый литерал HtmlParser("<html>…")
+    // молча выбирал бы потоковый режим вместо разбора строки
+    struct Streaming
+    {
+    };
+    static constexpr Streaming streaming{};
+
+    HtmlParser(const string &html) : html_content(html), doc(nullptr)
+    {
+        doc = htmlReadDoc((const xmlChar *)html_content.c_str(),
+                          NULL, NULL,
+                          HTML_PARSE_FLAGS);
+
+        // Добавьте проверку
+        if (!doc)
+            report_failure();
+    }
+
+    // Потоковый режим: документ строится по мере поступления данных через feed(), затем finish().
+    // keep_raw сохраняет копию исходного HTML — она нужна только find_by_regex и для отладки
+    HtmlParser(Streaming, bool keep_raw, HtmlParserPool *pool = nullptr, string host = "")
+        : doc(nullptr), pool(pool), host(move(host)), keep_raw(keep_raw) {}
+
+    void feed(const char *data, size_t size)
+    {
+        auto start = chrono::steady_clock::now();
+        if (keep_raw)
+            html_content.append(data, size);
+        if (!push_ctxt && pool)
+        {
+            push_ctxt = pool->acquire(host);
+        }
+        else if (!push_ctxt)
+        {
+            push_ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL, XML_CHAR_ENCODING_NONE);
+            if (push_ctxt)
+                htmlCtxtUseOptions(push_ctxt, HTML_PARSE_FLAGS);
+        }
+        if (!push_ctxt)
+            return;
+        htmlParseChunk(push_ctxt, data, (int)size, 0);
+        parse_time += chrono::steady_clock::now() - start;
+    }
+
+    void finish()
+    {
+        if (!push_ctxt)
+            return;
+        auto start = chrono::steady_clock::now();
+        htmlParseChunk(push_ctxt, NULL, 0, 1);
+        parse_time += chrono::steady_clock::now() - start;
+        doc = push_ctxt->myDoc;
+        push_ctxt->myDoc = nullptr;
+        if (pool)
+            pool->release(push_ctxt, host, doc);
+        else
+            htmlFreeParserCtxt(push_ctxt);
+        push_ctxt = nullptr;
+        if (!doc)
+            report_failure();
+    }
+
+    ~HtmlParser()
+    {
+        if (xpath_ctx)
+            xmlXPathFreeContext(xpath_ctx);
+        if (push_ctxt)
+        {
+            if (push_ctxt->myDoc)
+                xmlFreeDoc(push_ctxt->myDoc);
+            htmlFreeParserCtxt(push_ctxt);
+        }
+        if (doc)
+        {
+            xmlFreeDoc(doc);
+            LOG(Debug) << "HTML parser resources freed";
+        }
+    }
+
+    bool is_valid() const
+    {
+        return doc != nullptr;
+    }
+
+    chrono::steady_clock::duration parse_duration() const
+    {
+        return parse_time;
+    }
+
+    // Вычисляет выражение над документом; результат освобождает вызывающий
+    xmlXPathObjectPtr eval(const CompiledXPath &xpath)
+    {
+        if (!doc)
+            return nullptr;
+        if (!xpath_ctx)
+            xpath_ctx = xmlXPathNewContext(doc);
+        if (!xpath_ctx)
+        {
+            LOG(Error) << "Failed to create XPath context";
+            return nullptr;
+        }
+        ScopedTimer timer(xpath.eval_time);
+        return xmlXPathCompiledEval(xpath.get(), xpath_ctx);
+    }
+
+    vector<string> find_by_xpath(const CompiledXPath &xpath)
+    {
+        vector<string> results;
+        if (!doc)
+        {
+            LOG(Error) << "No valid document for XPath search";
+            return results;
+        }
+
+        LOG(Debug) << "Searching with XPath: " << xpath.expr();
+        xmlXPathObjectPtr result = eval(xpath);
+
+        if (result && result->nodesetval)
+        {
+            LOG(Debug) << "Found " << result->nodesetval->nodeNr << " elements";
+            results.resize(result->nodesetval->nodeNr);
+            for (int i = 0; i < result->nodesetval->nodeNr; ++i)
+            {
+                append_node_text(result->nodesetval->nodeTab[i], results[i]);
+            }
+        }
+        else
+        {
+            LOG(Debug) << "No elements found with XPath: " << xpath.expr();
+        }
+
+        xmlXPathFreeObject(result);
+        return results;
+    }
+
+    // Текст всех найденных узлов одним буфером, блоки разделены переводом строки.
+    // Результат указывает во внутренний буфер: он действителен, пока жив парсер
+    // и до следующего вызова extract_text.
+    string_view extract_text(const CompiledXPath &xpath)
+    {
+        text_buffer.clear();
+        if (!doc)
+        {
+            LOG(Error) << "No valid document for XPath search";
+            return {};
+        }
+
+        xmlXPathObjectPtr result = eval(xpath);
+        int count = (result && result->nodesetval) ? result->nodesetval->nodeNr : 0;
+        LOG(Debug) << "Found " << count << " elements with XPath: " << xpath.expr();
+        for (int i = 0; i < count; ++i)
+        {
+            append_node_text(result->nodesetval->nodeTab[i], text_buffer);
+            text_buffer += '\n';
+        }
+        xmlXPathFreeObject(result);
+        return text_buffer;
+    }
+
+    // Значения атрибута attr найденных элементов; узлы-атрибуты (.../@href) берутся как есть
+    vector<string> find_attribute_values(const CompiledXPath &xpath, const char *attr)
+    {
+        vector<string> results;
+        xmlXPathObjectPtr result = eval(xpath);
+        if (result && result->nodesetval)
+        {
+            for (int i = 0; i < result->nodesetval->nodeNr; ++i)
+            {
+                xmlNodePtr node = result->nodesetval->nodeTab[i];
+                xmlChar *value = node->type == XML_ATTRIBUTE_NODE
+                                     ? xmlNodeGetContent(node)
+                                     : xmlGetProp(node, (const xmlChar *)attr);
+                if (value)
+                {
+                    results.push_back(string((char *)value));
+                    xmlFree(value);
+                }
+            }
+        }
+        xmlXPathFreeObject(result);
+        return results;
+    }
+
+    vector<string> find_by_class(const string &class_name)
+    {
+        return find_by_xpath(*CompiledXPath::compile("//*[contains(@class, '" + class_name + "')]"));
+    }
+
+    vector<string> find_by_selector(const string &selector)
+    {
+        return find_by_xpath(*CompiledXPath::compile(selector));
+    }
+
+    vector<string> find_by_regex(const string &pattern)
+    {
+        vector<string> results;
+        if (!doc)
+        {
+            LOG(Error) << "No valid document for regex search";
+            return results;
+        }
+
+        if (!keep_raw)
+        {
+            LOG(Error) << "Raw HTML was not kept for regex search";
+            return results;
+        }
+
+        LOG(Debug) << "Searching with regex pattern: " << pattern;
+        shared_ptr<const regex> re = RegexSet::compile(pattern);
+
+        sregex_iterator it(html_content.cbegin(), html_content.cend(), *re);
+        sregex_iterator end;
+
+        int count = 0;
+        for (; it != end; ++it)
+        {
+            results.push_back(it->str());
+            count++;
+        }
+
+        LOG(Debug) << "Found " << count << " regex matches";
+        return results;
+    }
+
+    string get_element_content(const string &xpath)
+    {
+        if (!doc)
+            return "";
+
+        // Добавим проверку выражения
+        if (xpath.empty())
+        {
+            LOG(Error) << "XPath expression is empty!";
+            return "";
+        }
+
+        LOG(Debug) << "Executing XPath: " << xpath;
+
+        xmlXPathObjectPtr result = eval(*CompiledXPath::compile(xpath));
+        string content;
+
+        if (result)
+        {
+            if (result->nodesetval && result->nodesetval->nodeNr > 0)
+            {
+                LOG(Debug) << "Found " << result->nodesetval->nodeNr << " nodes";
+                xmlNodePtr node = result->nodesetval->nodeTab[0];
+                xmlChar *text = xmlNodeGetContent(node);
+                if (text)
+                {
+                    content = string((char *)text);
+                    xmlFree(text);
+
+                    // Отладочный вывод первых 100 символов
+                    LOG(Debug) << "Content preview: "
+                               << content.substr(0, min(100, (int)content.size()))
+                               << (content.size() > 100 ? "..." : "");
+                }
+            }
+            else
+            {
+                LOG(Warning) << "No nodes found for XPath";
+            }
+            xmlXPathFreeObject(result);
+        }
+        else
+        {
+            LOG(Error) << "XPath evaluation failed";
+        }
+
+        return content;
+    }
+};
+
+// Извлекает хост из URL (схема://хост/путь)
+string url_host(const string &url)
+{
+    size_t start = url.find("://");
+    start = (start == string::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    return url.substr(start, end == string::npos ? string::npos : end - start);
+}
+
+// --- xxHash64 ---
+// Быстрый некриптографический хэш (алгоритм XXH64) для отпечатков текста и длинных URL
+uint64_t xxhash64(const char *data, size_t len, uint64_t seed = 0)
+{
+    const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL,
+                   P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r)
+    { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const char *p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    };
+    auto round = [&](uint64_t acc, uint64_t input)
+    { return rotl(acc + input * P2, 31) * P1; };
+    auto merge = [&](uint64_t acc, uint64_t v)
+    { return (acc ^ round(0, v)) * P1 + P4; };
+
+    const char *p = data, *end = data + len;
+    uint64_t h;
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    }
+    else
+    {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h = rotl(h ^ (v * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ ((unsigned char)*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Параметры, которые добавляют рассылки и соцсети и которые не меняют страницу
+bool is_tracking_param(const string &name)
+{
+    static const set<string> names = {"fbclid", "gclid", "dclid", "yclid", "msclkid", "igshid",
+                                      "mc_cid", "mc_eid", "_hsenc", "_hsmi", "ref_src"};
+    return name.compare(0, 4, "utm_") == 0 || names.count(name) > 0;
+}
+
+// Канонический вид URL статьи: схема и хост в нижнем регистре, без порта по умолчанию,
+// фрагмента и параметров отслеживания. Порядок остальных параметров сохраняется —
+// на некоторых сайтах он значим.
+string canonicalize_url(const string &url)
+{
+    size_t scheme_end = url.find("://");
+    if (scheme_end == string::npos)
+        return url;
+    size_t host_start = scheme_end + 3;
+    size_t host_end = min(url.find_first_of("/?#", host_start), url.size());
+
+    string scheme = url.substr(0, scheme_end);
+    string host = url.substr(host_start, host_end - host_start);
+    transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+    transform(host.begin(), host.end(), host.begin(), ::tolower);
+    string default_port = scheme == "https" ? ":443" : scheme == "http" ? ":80" : "";
+    if (!default_port.empty() && host.size() > default_port.size() &&
+        host.compare(host.size() - default_port.size(), default_port.size(), default_port) == 0)
+        host.resize(host.size() - default_port.size());
+
+    string rest = url.substr(host_end);
+    rest = rest.substr(0, rest.find('#'));
+    size_t query_start = rest.find('?');
+    string path = rest.substr(0, query_start);
+    string query;
+    if (query_start != string::npos)
+    {
+        stringstream params(rest.substr(query_start + 1));
+        string param;
+        while (getline(params, param, '&'))
+        {
+            if (!param.empty() && !is_tracking_param(param.substr(0, param.find('='))))
+                query += (query.empty() ? "?" : "&") + param;
+        }
+    }
+    return scheme + "://" + host + (path.empty() ? "/" : path) + query;
+}
+
+// Ключ URL в таблице articles (VARCHAR(191)) и в индексе просмотренных URL.
+// Длинный URL укорачивается и получает хэш целого, чтобы не обрезаться молча
+// и не совпасть с другим URL с тем же началом. Для ключа функция возвращает его же.
+const size_t URL_KEY_MAX = 191;
+
+string url_key(const string &url)
+{
+    if (url.size() <= URL_KEY_MAX)
+        return url;
+    char suffix[18];
+    snprintf(suffix, sizeof(suffix), "#%016llx", (unsigned long long)xxhash64(url.data(), url.size()));
+    return url.substr(0, URL_KEY_MAX - 17) + suffix;
+}
+
+// --- Таймауты и повторы загрузки (options сайта в config.json) ---
+struct FetchPolicy
+{
+    long connect_timeout_ms = 10000; // options.connect_timeout, секунды
+    long timeout_ms = 30000;         // options.timeout: предел одной попытки целиком, секунды
+    long low_speed_limit = 1024;     // options.low_speed_limit: байт/с, медленнее — обрыв...
+    long low_speed_time = 15;        // ...если так держится options.low_speed_time секунд
+    int retries = 2;                 // options.retries: повторы после первой попытки
+    long backoff_ms = 1000;          // options.retry_backoff: пауза перед первым повтором, секунды; дальше удваивается
+    string user_agent = "Mozilla/5.0"; // options.user_agent
+    vector<string> headers;            // options.request_headers, "Имя: значение"; до заголовков запроса
+};
+
+// --- Запрос на загрузку: URL и дополнительные заголовки ---
+struct FetchRequest
+{
+    string url;
+    vector<string> headers; // "Имя: значение"
+    FetchPolicy policy;
+    bool parse_html = false; // разбирать HTML по мере загрузки вместо накопления в body
+    bool keep_raw = false;   // при parse_html сохранять ещё и исходный HTML
+
+    FetchRequest(const string &url, vector<string> headers = {}) : url(url), headers(move(headers)) {}
+};
+
+// --- Результат одной загрузки ---
+struct FetchResult
+{
+    string url;
+    string body;
+    size_t index = 0; // позиция в исходном списке URL
+    long http_code = 0;
+    CURLcode code = CURLE_OK;
+    string etag;          // валидаторы ответа для условных запросов
+    string last_modified;
+    unique_ptr<HtmlParser> parser; // при parse_html всегда задан (при ошибке документ невалиден)
+    uint64_t wire_bytes = 0;    // тело ответа в сети (сжатое, если сервер сжимал)
+    uint64_t decoded_bytes = 0; // тело после распаковки — столько получил парсер или body
+    int attempts = 0;           // сделано попыток
+    bool circuit_open = false;  // хост отключён предохранителем, запрос не отправлялся
+
+    // Очищает результат неудачной попытки перед повтором
+    void reset_attempt()
+    {
+        body.clear();
+        parser.reset();
+        http_code = 0;
+        code = CURLE_OK;
+        etag.clear();
+        last_modified.clear();
+        wire_bytes = decoded_bytes = 0;
+    }
+
+    bool ok() const
+    {
+        return code == CURLE_OK && http_code >= 200 && http_code < 400;
+    }
+    // Сбой, который говорит о проблеме хоста, а не конкретной страницы: сеть, таймаут, 5xx, 429
+    bool host_failure() const
+    {
+        return code != CURLE_OK || http_code >= 500 || http_code == 429;
+    }
+    bool not_modified() const
+    {
+        return code == CURLE_OK && http_code == 304;
+    }
+};
+
+// curl распаковывает gzip/brotli/zstd по мере приёма и отдаёт сюда уже распакованные куски
+size_t WriteCallback(void *contents, size_t size, size_t nmemb, FetchResult *result)
+{
+    size_t total_size = size * nmemb;
+    result->body.append((char *)contents, total_size);
+    result->decoded_bytes += total_size;
+    return total_size;
+}
+
+// Передаёт данные прямо в потоковый парсер, не накапливая тело ответа
+size_t ParseCallback(void *contents, size_t size, size_t nmemb, FetchResult *result)
+{
+    size_t total_size = size * nmemb;
+    result->parser->feed((const char *)contents, total_size);
+    result->decoded_bytes += total_size;
+    return total_size;
+}
+
+// Запоминает ETag и Last-Modified из заголовков ответа (последнего, если были редиректы)
+size_t HeaderCallback(char *buffer, size_t size, size_t nitems, FetchResult *result)
+{
+    size_t total_size = size * nitems;
+    string line(buffer, total_size);
+    size_t colon = line.find(':');
+    if (line.compare(0, 5, "HTTP/") == 0)
+    {
+        result->etag.clear();
+        result->last_modified.clear();
+    }
+    else if (colon != string::npos)
+    {
+        string name = line.substr(0, colon);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t begin = line.find_first_not_of(" \t", colon + 1);
+        size_t end = line.find_last_not_of(" \t\r\n");
+        string value = (begin == string::npos || end < begin) ? "" : line.substr(begin, end - begin + 1);
+        if (name == "etag")
+            result->etag = value;
+        else if (name == "last-modified")
+            result->last_modified = value;
+    }
+    return total_size;
+}
+
+// --- Общие для всех загрузок кэши curl: DNS и TLS-сессии ---
+// Блокировки нужны, чтобы объект можно было разделять между потоками.
+// Кэш соединений здесь не разделяется: он живёт в multi-хэндле каждого Fetcher,
+// а передачи из чужого multi не будятся при освобождении соединения.
+class CurlShare
+{
+private:
+    CURLSH *share;
+    mutex locks[CURL_LOCK_DATA_LAST];
+
+    static void lock_cb(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+    {
+        static_cast<CurlShare *>(userptr)->locks[data].lock();
+    }
+    static void unlock_cb(CURL *, curl_lock_data data, void *userptr)
+    {
+        static_cast<CurlShare *>(userptr)->locks[data].unlock();
+    }
+
+public:
+    CurlShare() : share(curl_share_init())
+    {
+        if (!share)
+            throw runtime_error("Failed to initialize CURL share handle");
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock_cb);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock_cb);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    ~CurlShare()
+    {
+        curl_share_cleanup(share);
+    }
+    CurlShare(const CurlShare &) = delete;
+    CurlShare &operator=(const CurlShare &) = delete;
+
+    CURLSH *handle() const { return share; }
+};
+
+// --- Вежливость к сайтам: минимальный интервал между запросами к одному хосту ---
+// Общий для всех потоков, поэтому разные сайты не ждут друг друга.
+class HostThrottle
+{
+private:
+    using Clock = chrono::steady_clock;
+    mutex mtx;
+    map<string, Clock::time_point> next_slot;
+    Clock::duration interval;
+
+public:
+    explicit HostThrottle(double delay_seconds)
+    {
+        set_interval(delay_seconds);
+    }
+
+    void set_interval(double delay_seconds)
+    {
+        lock_guard<mutex> lock(mtx);
+        interval = chrono::duration_cast<Clock::duration>(chrono::duration<double>(max(0.0, delay_seconds)));
+    }
+
+    // Занимает слот для хоста и возвращает 0, либо сколько миллисекунд ещё ждать
+    long try_acquire(const string &host)
+    {
+        lock_guard<mutex> lock(mtx);
+        Clock::time_point now = Clock::now();
+        Clock::time_point &slot = next_slot[host];
+        if (slot > now)
+            return max(1L, (long)chrono::duration_cast<chrono::milliseconds>(slot - now).count());
+        slot = now + interval;
+        return 0;
+    }
+};
+
+// --- Предохранитель: хост, который раз за разом не отвечает, на время отключается ---
+// После threshold сбоев подряд запросы к хосту сразу завершаются ошибкой в течение cooldown.
+// Затем пропускается один пробный запрос: успех возвращает хост в работу, сбой снова
+// отключает его на вдвое больший срок (не больше 16 cooldown).
+class CircuitBreaker
+{
+private:
+    using Clock = chrono::steady_clock;
+    struct State
+    {
+        int failures = 0;
+        int trips = 0;            // сколько раз подряд хост отключался
+        Clock::time_point open_until;
+        bool probing = false;     // пробный запрос уже отправлен
+    };
+    mutex mtx;
+    map<string, State> hosts;
+    int threshold;
+    chrono::seconds cooldown;
+
+public:
+    CircuitBreaker(int threshold, int cooldown_seconds)
+    {
+        configure(threshold, cooldown_seconds);
+    }
+
+    void configure(int threshold, int cooldown_seconds)
+    {
+        lock_guard<mutex> lock(mtx);
+        this->threshold = max(1, threshold);
+        cooldown = chrono::seconds(max(1, cooldown_seconds));
+    }
+
+    // Можно ли отправить запрос к хосту сейчас. Разрешённый пробный запрос закрепляется
+    // за вызывающим: его итог обязательно передаётся в record() или отменяется cancel_probe()
+    bool allow(const string &host)
+    {
+        lock_guard<mutex> lock(mtx);
+        State &state = hosts[host];
+        if (state.trips == 0)
+            return true;
+        if (Clock::now() < state.open_until || state.probing)
+            return false;
+        state.probing = true;
+        return true;
+    }
+
+    // Пробный запрос так и не был отправлен — следующий может пробовать снова
+    void cancel_probe(const string &host)
+    {
+        lock_guard<mutex> lock(mtx);
+        hosts[host].probing = false;
+    }
+
+    void record(const string &host, bool success)
+    {
+        lock_guard<mutex> lock(mtx);
+        State &state = hosts[host];
+        if (success)
+        {
+            if (state.trips)
+                LOG(Info) << "Circuit closed for " << host;
+            state = State();
+            return;
+        }
+        state.probing = false;
+        if (++state.failures < threshold && state.trips == 0)
+            return;
+        auto duration = cooldown * (1 << min(state.trips, 4));
+        state.trips++;
+        state.failures = 0;
+        state.open_until = Clock::now() + duration;
+        metrics.counter("parser_circuit_open_total", {{"host", host}})++;
+        LOG(Warning) << "Circuit open for " << host << ": pausing requests for "
+                     << chrono::duration_cast<chrono::seconds>(duration).count() << " seconds";
+    }
+};
+
+// --- Параллельная загрузка через curl multi ---
+// Держит до max_parallel передач одновременно, не более max_per_host на один хост.
+// Остальные URL ждут в очереди и запускаются по мере завершения текущих.
+// Сторонний источник событий, обслуживаемый циклом Fetcher наравне с передачами curl
+class EventSource
+{
+public:
+    virtual ~EventSource() = default;
+    // Продвигает свою работу без блокировки
+    virtual void perform() = 0;
+    // Добавляет сокеты, которых стоит дождаться, и возвращает допустимое время ожидания
+    virtual long wait_fds(vector<curl_waitfd> &fds, long wait_ms) const = 0;
+};
+
+// Easy-хэндлы не уничтожаются после загрузки, а возвращаются в пул: соединения
+// остаются открытыми (keep-alive, HTTP/2 мультиплексирование) до конца работы.
+// Так же переиспользуются контексты разбора HTML (HtmlParserPool).
+class Fetcher
+{
+private:
+    CURLM *multi;
+    CurlShare &share;
+    HostThrottle &throttle;
+    CircuitBreaker &breaker;
+    mt19937 rng{random_device{}()};
+    int max_parallel;
+    int max_per_host;
+    vector<CURL *> idle; // пул готовых к повторному использованию easy-хэндлов
+    HtmlParserPool parsers;
+    EventSource *events = nullptr;
+    vector<curl_waitfd> extra_fds;
+
+    // Передача в процессе: результат и список заголовков, живущий до её завершения
+    struct Transfer
+    {
+        FetchResult result;
+        curl_slist *headers = nullptr;
+    };
+
+    CURL *make_easy(Transfer &slot, const FetchRequest &request, size_t index)
+    {
+        CURL *curl;
+        if (!idle.empty())
+        {
+            curl = idle.back();
+            idle.pop_back();
+            curl_easy_reset(curl);
+        }
+        else
+        {
+            curl = curl_easy_init();
+            if (!curl)
+                return nullptr;
+        }
+        curl_easy_setopt(curl, CURLOPT_SHARE, share.handle());
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // сигналы обрабатывает основной поток
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+        curl_easy_setopt(curl, CURLOPT_URL, slot.result.url.c_str());
+        // Каждая попытка ограничена по времени: зависший хост не держит сайт дольше retries × timeout
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, request.policy.connect_timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, request.policy.timeout_ms);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, request.policy.low_speed_limit);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, request.policy.low_speed_time);
+        if (request.parse_html)
+        {
+            slot.result.parser = make_unique<HtmlParser>(HtmlParser::streaming, request.keep_raw, &parsers, url_host(slot.result.url));
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ParseCallback);
+        }
+        else
+        {
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &slot.result);
+        // Пустая строка — предложить все поддерживаемые сборкой curl кодировки (gzip, br, zstd)
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &slot.result);
+        for (const string &header : request.policy.headers)
+            slot.headers = curl_slist_append(slot.headers, header.c_str());
+        for (const string &header : request.headers)
+            slot.headers = curl_slist_append(slot.headers, header.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, slot.headers);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, request.policy.user_agent.c_str());
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *)index);
+        return curl;
+    }
+
+    // Фазы передачи из curl (значения накопительные от начала запроса). DNS, соединение и TLS
+    // пишутся только для новых соединений, иначе нули от keep-alive размывают распределение.
+    static void record_timings(CURL *curl, const string &host, bool new_connection)
+    {
+        curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+        auto phase = [&](const char *name, curl_off_t us)
+        {
+            metrics.histogram("parser_fetch_seconds", {{"host", host}, {"phase", name}}).observe((uint64_t)max<curl_off_t>(0, us));
+        };
+        if (new_connection)
+        {
+            phase("dns", dns);
+            phase("connect", connect - dns);
+            if (tls > 0)
+                phase("tls", tls - connect);
+        }
+        phase("ttfb", ttfb);
+        phase("total", total);
+    }
+
+public:
+    Fetcher(CurlShare &share, HostThrottle &throttle, CircuitBreaker &breaker, int max_parallel, int max_per_host)
+        : multi(curl_multi_init()),
+          share(share),
+          throttle(throttle),
+          breaker(breaker),
+          max_parallel(max(1, max_parallel)),
+          max_per_host(max(1, max_per_host))
+    {
+        if (!multi)
+            throw runtime_error("Failed to initialize CURL multi handle");
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)this->max_per_host);
+    }
+    ~Fetcher()
+    {
+        for (CURL *curl : idle)
+            curl_easy_cleanup(curl);
+        curl_multi_cleanup(multi);
+    }
+    Fetcher(const Fetcher &) = delete;
+    Fetcher &operator=(const Fetcher &) = delete;
+
+    // Пока идут загрузки, цикл заодно обслуживает source (например, запросы AsyncDb)
+    void attach(EventSource *source)
+    {
+        events = source;
+    }
+
+    // Загружает все URL, вызывая on_done для каждого по мере завершения (в порядке готовности)
+    void fetch(const vector<FetchRequest> &requests, const function<void(FetchResult &)> &on_done)
+    {
+        using Clock = chrono::steady_clock;
+        vector<Transfer> slots(requests.size());
+        vector<Clock::time_point> not_before(requests.size()); // повтор не раньше этого момента
+        deque<size_t> queue;
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            slots[i].result.url = requests[i].url;
+            slots[i].result.index = i;
+            queue.push_back(i);
+        }
+
+        map<string, int> host_active;
+        int in_flight = 0;
+
+        while (!queue.empty() || in_flight > 0)
+        {
+            if (events)
+                events->perform();
+
+            // Запускаем ожидающие передачи с учётом общего лимита, лимита на хост и интервала вежливости
+            long wait_ms = 1000;
+            for (auto it = queue.begin(); it != queue.end() && in_flight < max_parallel;)
+            {
+                size_t index = *it;
+                string host = url_host(slots[index].result.url);
+                Clock::time_point now = Clock::now();
+                if (not_before[index] > now)
+                {
+                    wait_ms = min(wait_ms, 1 + (long)chrono::duration_cast<chrono::milliseconds>(not_before[index] - now).count());
+                    ++it;
+                    continue;
+                }
+                if (host_active[host] >= max_per_host)
+                {
+                    ++it;
+                    continue;
+                }
+                if (long delay_ms = throttle.try_acquire(host))
+                {
+                    wait_ms = min(wait_ms, delay_ms);
+                    ++it;
+                    continue;
+                }
+                // Выключатель спрашивается последним: разрешённый им пробный запрос уходит сразу
+                if (!breaker.allow(host))
+                {
+                    it = queue.erase(it);
+                    LOG(Warning) << "Circuit open, not fetching " << slots[index].result.url;
+                    slots[index].result.code = CURLE_COULDNT_CONNECT;
+                    slots[index].result.circuit_open = true;
+                    if (requests[index].parse_html)
+                        slots[index].result.parser = make_unique<HtmlParser>(HtmlParser::streaming, false);
+                    on_done(slots[index].result);
+                    continue;
+                }
+                it = queue.erase(it);
+                slots[index].result.attempts++;
+
+                LOG(Debug) << "Downloading URL: " << slots[index].result.url;
+                CURL *curl = make_easy(slots[index], requests[index], index);
+                if (!curl)
+                {
+                    LOG(Error) << "Failed to initialize CURL";
+                    breaker.cancel_probe(host);
+                    slots[index].result.code = CURLE_FAILED_INIT;
+                    if (requests[index].parse_html)
+                        slots[index].result.parser = make_unique<HtmlParser>(HtmlParser::streaming, false);
+                    on_done(slots[index].result);
+                    continue;
+                }
+                curl_multi_add_handle(multi, curl);
+                host_active[host]++;
+                in_flight++;
+            }
+
+            int still_running = 0;
+            curl_multi_perform(multi, &still_running);
+
+            int msgs_left = 0;
+            while (CURLMsg *msg = curl_multi_info_read(multi, &msgs_left))
+            {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+
+                CURL *curl = msg->easy_handle;
+                void *priv = nullptr;
+                curl_easy_getinfo(curl, CURLINFO_PRIVATE, &priv);
+                Transfer &transfer = slots[(size_t)priv];
+                FetchResult &result = transfer.result;
+                result.code = msg->data.result;
+
+                string host = url_host(result.url);
+                if (result.code != CURLE_OK)
+                {
+                    LOG(Error) << "curl: " << curl_easy_strerror(result.code)
+                               << " (" << result.url << ")";
+                    metrics.counter("parser_fetch_errors_total", {{"host", host}})++;
+                }
+                else
+                {
+                    long new_connects = 0;
+                    curl_off_t downloaded = 0;
+                    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &result.http_code);
+                    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connects);
+                    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+                    result.wire_bytes = (uint64_t)downloaded;
+                    LOG(Debug) << "HTTP status: " << result.http_code << ", downloaded "
+                               << downloaded << " bytes (" << result.decoded_bytes << " decoded)"
+                               << (new_connects == 0 ? ", reused connection" : "")
+                               << " (" << result.url << ")";
+                    record_timings(curl, host, new_connects > 0);
+                    metrics.counter("parser_fetch_bytes_total", {{"host", host}}) += result.wire_bytes;
+                    metrics.counter("parser_fetch_decoded_bytes_total", {{"host", host}}) += result.decoded_bytes;
+                }
+
+                curl_multi_remove_handle(multi, curl);
+                idle.push_back(curl);
+                curl_slist_free_all(transfer.headers);
+                transfer.headers = nullptr;
+                host_active[host]--;
+                in_flight--;
+
+                // Сбой хоста повторяется с экспоненциальной паузой и разбросом ±50%
+                const FetchPolicy &policy = requests[result.index].policy;
+                breaker.record(host, !result.host_failure());
+                if (result.host_failure() && result.attempts <= policy.retries)
+                {
+                    double delay_ms = policy.backoff_ms * pow(2.0, result.attempts - 1) *
+                                      uniform_real_distribution<double>(0.5, 1.5)(rng);
+                    LOG(Warning) << "Retrying " << result.url << " in " << (long)delay_ms << " ms (attempt "
+                                 << result.attempts + 1 << " of " << policy.retries + 1 << ")";
+                    metrics.counter("parser_fetch_retries_total", {{"host", host}})++;
+                    result.reset_attempt();
+                    not_before[result.index] = Clock::now() + chrono::milliseconds((long)delay_ms);
+                    queue.push_back(result.index);
+                    continue;
+                }
+
+                if (result.parser)
+                {
+                    result.parser->finish();
+                    metrics.histogram("parser_html_parse_seconds", {{"host", host}}).observe(result.parser->parse_duration());
+                }
+                on_done(result);
+            }
+
+            if (in_flight > 0 || !queue.empty())
+            {
+                extra_fds.clear();
+                if (events)
+                    wait_ms = events->wait_fds(extra_fds, wait_ms);
+                curl_multi_poll(multi, extra_fds.data(), extra_fds.size(), (int)wait_ms, nullptr);
+            }
+        }
+    }
+
+    // Загружает все URL и возвращает результаты в исходном порядке
+    vector<FetchResult> fetch_all(const vector<FetchRequest> &requests)
+    {
+        vector<FetchResult> results(requests.size());
+        fetch(requests, [&](FetchResult &r)
+              { results[r.index] = move(r); });
+        return results;
+    }
+};
+
+// --- Валидаторы HTTP-кэша для страниц-списков (ETag / Last-Modified) ---
+// Хранятся в JSON-файле между запусками; неизменившаяся страница отвечает 304 без тела.
+class ValidatorCache
+{
+private:
+    string path;
+    mutex mtx;
+    Json::Value entries; // url -> {"etag": ..., "last_modified": ...}
+
+public:
+    explicit ValidatorCache(const string &path) : path(path), entries(Json::objectValue)
+    {
+        ifstream ifs(path);
+        if (ifs)
+        {
+            Json::CharReaderBuilder builder;
+            string errors;
+            if (!Json::parseFromStream(builder, ifs, &entries, &errors) || !entries.isObject())
+            {
+                LOG(Error) << "Ignoring broken validator cache " << path << ": " << errors;
+                entries = Json::Value(Json::objectValue);
+            }
+        }
+    }
+
+    // Заголовки If-None-Match / If-Modified-Since для условного запроса
+    vector<string> request_headers(const string &url)
+    {
+        lock_guard<mutex> lock(mtx);
+        vector<string> headers;
+        const Json::Value &entry = entries[url];
+        if (!entry["etag"].asString().empty())
+            headers.push_back("If-None-Match: " + entry["etag"].asString());
+        if (!entry["last_modified"].asString().empty())
+            headers.push_back("If-Modified-Since: " + entry["last_modified"].asString());
+        return headers;
+    }
+
+    // Запоминает валидаторы успешного ответа и сразу сохраняет файл
+    void update(const FetchResult &result)
+    {
+        if (result.http_code != 200 || (result.etag.empty() && result.last_modified.empty()))
+            return;
+
+        lock_guard<mutex> lock(mtx);
+        Json::Value &entry = entries[result.url];
+        entry["etag"] = result.etag;
+        entry["last_modified"] = result.last_modified;
+
+        string tmp_path = path + ".tmp";
+        ofstream ofs(tmp_path);
+        ofs << entries;
+        ofs.close();
+        if (!ofs || rename(tmp_path.c_str(), path.c_str()) != 0)
+            LOG(Error) << "Failed to save validator cache: " << path;
+    }
+};
+
+// --- Постраничный обход списка статей (options.pagination) ---
+struct Pagination
+{
+    enum Type
+    {
+        None,
+        NextLink,       // "next_link": адрес следующей страницы берётся из текущей (next_xpath)
+        PageParam,      // "page_param": страницы с номером в адресе (?page=N или url_template)
+        InfiniteScroll  // "infinite_scroll": страницы подгрузки по endpoint с номером {page}
+    };
+    Type type = None;
+    shared_ptr<const CompiledXPath> next_xpath;
+    string url_template;        // адрес страницы, {page} заменяется номером
+    int first_page = 2;         // номер, под которым в url_template идёт вторая страница списка
+    int prefetch = 3;           // сколько следующих страниц загружается параллельно
+    int max_pages = 5;          // сколько страниц списка обходить, включая первую
+    bool json = false;          // infinite_scroll: ответ в JSON ("format": "json")
+    string html_field;          // JSON: поле с HTML-фрагментом, к которому применяется link_pattern
+    string link_field = "link"; // JSON без html_field: ссылки — значения всех полей с этим именем
+
+    // Адрес k-й страницы списка (k >= 2)
+    string page_url(int k) const
+    {
+        string url = url_template;
+        size_t pos = url.find("{page}");
+        if (pos != string::npos)
+            url.replace(pos, 6, to_string(first_page + k - 2));
+        return url;
+    }
+};
+
+struct SiteConfig
+{
+    string url;
+    string link_pattern;
+    string content_block;
+    int max_pages = 10; // сколько статей брать за опрос (страниц списка — pagination.max_pages)
+    Pagination pagination;
+    // link_pattern и content_block, скомпилированные при чтении конфига
+    shared_ptr<const CompiledXPath> link_xpath;
+    shared_ptr<const CompiledXPath> content_xpath;
+    RegexSet link_filter; // пустой — принимаются все ссылки
+    int poll_interval = 0;     // начальный интервал опроса, секунды; 0 — общий poll_interval
+    int min_poll_interval = 0; // пределы подстройки интервала; 0 — общие из ParserConfig
+    int max_poll_interval = 0;
+    FetchPolicy fetch_policy;
+};
+
+struct DbConfig {
+    string host = "localhost";
+    string user = "root";
+    string password = "";
+    string database = "cyberlaw";
+    unsigned int port = 3306;
+};
+
+struct ParserConfig
+{
+    vector<SiteConfig> sites;
+    string output_dir = "output";
+    double request_delay = 1; // интервал между запросами к одному хосту, секунды
+    int site_workers = 4;     // сколько сайтов обрабатывается одновременно
+    bool debug_html = false;  // хранить исходный HTML страниц (сохраняется при ошибке разбора)
+    int poll_interval = 300;  // начальный интервал опроса сайта, секунды
+    int min_poll_interval = 60;    // интервал опроса подстраивается под частоту новых статей
+    int max_poll_interval = 3600;  // в этих пределах
+    int max_backoff = 3600;   // режим демона: предельный интервал после повторных ошибок
+    int extract_threads = 2;  // конвейер: потоки извлечения текста
+    int persist_threads = 2;  // конвейер: потоки записи в файлы и БД
+    int queue_capacity = 64;  // конвейер: размер очередей между стадиями
+    int max_parallel = 8;  // одновременных загрузок всего
+    int max_per_host = 4;  // одновременных загрузок на один хост
+    int metrics_port = 0;  // локальный порт эндпоинта метрик, 0 — только metrics.json в конце работы
+    LogLevel log_level = LogLevel::Info; // debug выводит каждый запрос и каждый XPath
+    int archive_segment_mb = 256; // архив статей: размер сегмента, после которого начинается новый
+    int archive_compression = 3;  // архив статей: уровень zstd, 0 — без сжатия
+    int breaker_threshold = 5;   // сбоев подряд, после которых хост временно отключается
+    int breaker_cooldown = 60;   // на сколько секунд отключается хост
+    int db_connections = 2;      // неблокирующих соединений с БД на поток сайтов
+    DbConfig db;
+    string post_url = "";
+};
+
+// --- MariaDB helpers ---
+MYSQL *init_db(const DbConfig &cfg)
+{
+    // Ошибки бросаются исключением: в режиме демона соединение переустанавливается позже
+    MYSQL *conn = mysql_init(nullptr);
+    if (!conn) {
+        throw runtime_error("mysql_init failed");
+    }
+    // Используем TCP/IP соединение, а не сокет
+    if (!mysql_real_connect(conn, cfg.host.c_str(), cfg.user.c_str(), cfg.password.c_str(),
+                            cfg.database.c_str(), cfg.port, NULL, 0)) {
+        string error = mysql_error(conn);
+        mysql_close(conn);
+        throw runtime_error("mysql_real_connect failed: " + error);
+    }
+    // Создать таблицы если не существуют
+    const char *create_sql[] = {
+        "CREATE TABLE IF NOT EXISTS articles (url VARCHAR(191) PRIMARY KEY)",
+        // Отпечатки содержимого: точный хэш и SimHash, разбитый на проиндексированные полосы
+        "CREATE TABLE IF NOT EXISTS article_fingerprints ("
+        "content_hash BIGINT UNSIGNED PRIMARY KEY, simhash BIGINT UNSIGNED NOT NULL, "
+        "band0 SMALLINT UNSIGNED NOT NULL, band1 SMALLINT UNSIGNED NOT NULL, "
+        "band2 SMALLINT UNSIGNED NOT NULL, band3 SMALLINT UNSIGNED NOT NULL, "
+        "url VARCHAR(2048) NOT NULL, "
+        "INDEX (band0), INDEX (band1), INDEX (band2), INDEX (band3))"};
+    for (const char *sql : create_sql) {
+        if (mysql_query(conn, sql)) {
+            string error = mysql_error(conn);
+            mysql_close(conn);
+            throw runtime_error("create table failed: " + error);
+        }
+    }
+    return conn;
+}
+
+// --- Подготовленное выражение MySQL ---
+// Параметры передаются серверу в бинарном виде: строки не экранируются и не копируются.
+class Statement
+{
+private:
+    MYSQL_STMT *stmt;
+    vector<MYSQL_BIND> params;
+    vector<unsigned long> lengths;
+    vector<long long> ints;
+
+public:
+    Statement(MYSQL *conn, const string &sql) : stmt(mysql_stmt_init(conn))
+    {
+        if (!stmt)
+            throw runtime_error("mysql_stmt_init failed");
+        if (mysql_stmt_prepare(stmt, sql.c_str(), sql.size()))
+        {
+            string error = mysql_stmt_error(stmt);
+            mysql_stmt_close(stmt);
+            throw runtime_error("Failed to prepare statement: " + error);
+        }
+        size_t count = mysql_stmt_param_count(stmt);
+        params.assign(count, MYSQL_BIND{});
+        lengths.assign(count, 0);
+        ints.assign(count, 0);
+    }
+    ~Statement()
+    {
+        mysql_stmt_close(stmt);
+    }
+    Statement(const Statement &) = delete;
+    Statement &operator=(const Statement &) = delete;
+
+    // Строка не копируется: value должна жить до вызова execute()
+    void bind(size_t i, string_view value)
+    {
+        lengths[i] = value.size();
+        params[i].buffer_type = MYSQL_TYPE_STRING;
+        params[i].buffer = (void *)value.data();
+        params[i].buffer_length = value.size();
+        params[i].length = &lengths[i];
+    }
+    void bind(size_t i, long long value)
+    {
+        ints[i] = value;
+        params[i].buffer_type = MYSQL_TYPE_LONGLONG;
+        params[i].buffer = &ints[i];
+        params[i].length = nullptr;
+        params[i].is_unsigned = false;
+    }
+    void bind(size_t i, uint64_t value)
+    {
+        bind(i, (long long)value);
+        params[i].is_unsigned = true;
+    }
+
+    bool execute()
+    {
+        if (mysql_stmt_bind_param(stmt, params.data()) || mysql_stmt_execute(stmt))
+        {
+            LOG(Error) << "statement failed: " << mysql_stmt_error(stmt);
+            return false;
+        }
+        return true;
+    }
+
+    // Число строк, изменённых последним execute()
+    uint64_t affected_rows()
+    {
+        return mysql_stmt_affected_rows(stmt);
+    }
+
+    // Считывает первый столбец результата последнего execute() как строки
+    vector<string> fetch_strings()
+    {
+        vector<string> rows;
+        char buf[1024];
+        unsigned long length = 0;
+        MYSQL_BIND result{};
+        result.buffer_type = MYSQL_TYPE_STRING;
+        result.buffer = buf;
+        result.buffer_length = sizeof(buf);
+        result.length = &length;
+
+        if (mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt))
+        {
+            LOG(Error) << "fetching result failed: " << mysql_stmt_error(stmt);
+            return rows;
+        }
+        int rc;
+        while ((rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED)
+        {
+            rows.emplace_back(buf, min<size_t>(length, sizeof(buf)));
+        }
+        mysql_stmt_free_result(stmt);
+        return rows;
+    }
+};
+
+// --- Соединение с БД и кэш подготовленных выражений ---
+// Каждое выражение готовится один раз за время жизни соединения.
+class Db
+{
+private:
+    DbConfig cfg;
+    MYSQL *conn;
+    map<string, unique_ptr<Statement>> statements;
+
+public:
+    explicit Db(const DbConfig &cfg) : cfg(cfg), conn(connect(cfg)) {}
+    ~Db()
+    {
+        statements.clear();
+        if (conn)
+            mysql_close(conn);
+    }
+    Db(const Db &) = delete;
+    Db &operator=(const Db &) = delete;
+
+    // Проверка дубликатов в транзакции записи должна видеть отпечатки, которые другой поток
+    // уже закоммитил: при REPEATABLE READ снимок берётся в начале транзакции
+    static MYSQL *connect(const DbConfig &cfg)
+    {
+        MYSQL *conn = init_db(cfg);
+        if (mysql_query(conn, "SET SESSION TRANSACTION ISOLATION LEVEL READ COMMITTED"))
+        {
+            string error = mysql_error(conn);
+            mysql_close(conn);
+            throw runtime_error("Failed to set isolation level: " + error);
+        }
+        return conn;
+    }
+
+    Statement &prepare(const string &sql)
+    {
+        unique_ptr<Statement> &statement = statements[sql];
+        if (!statement)
+            statement = make_unique<Statement>(conn, sql);
+        return *statement;
+    }
+
+    // Переподключается, если сервер закрыл соединение (долгие паузы в режиме демона)
+    void ensure_connected()
+    {
+        if (conn && mysql_ping(conn) == 0)
+            return;
+        LOG(Warning) << "Lost DB connection, reconnecting: " << (conn ? mysql_error(conn) : "");
+        statements.clear();
+        if (conn)
+            mysql_close(conn);
+        conn = nullptr;
+        conn = connect(cfg);
+    }
+
+    void begin()
+    {
+        if (mysql_autocommit(conn, false))
+            throw runtime_error(string("Failed to start transaction: ") + mysql_error(conn));
+    }
+    // Ошибка коммита бросается: незакоммиченные записи откатываются вместе с соединением
+    void commit()
+    {
+        if (mysql_commit(conn))
+            throw runtime_error(string("COMMIT failed: ") + mysql_error(conn));
+        mysql_autocommit(conn, true);
+    }
+};
+
+// --- Неблокирующие запросы к БД ---
+// Несколько соединений, на каждом не больше одного запроса в полёте. Запрос отправляется
+// через mysql_real_query_nonblocking и продвигается из цикла событий Fetcher: сокеты
+// соединений ждутся вместе с передачами curl, и задержка БД перекрывается с загрузками.
+// Только запросы без набора строк (INSERT/UPDATE): колбэк получает успех и число изменённых
+// строк. Объект однопоточный — свой у каждого потока сайтов.
+// У подготовленных выражений в C API нет неблокирующего выполнения, поэтому запросы текстовые.
+// Текст собирается, когда запросу достаётся соединение: значения экранируются на том
+// соединении, которое его выполнит (с его кодировкой).
+class AsyncDb : public EventSource
+{
+public:
+    using Callback = function<void(bool ok, uint64_t affected_rows)>;
+    using SqlBuilder = function<string(MYSQL *conn)>;
+
+private:
+    using Clock = chrono::steady_clock;
+    struct Query
+    {
+        SqlBuilder build;
+        string sql;      // собирается из build при отправке
+        Histogram *time; // время от постановки в очередь до ответа
+        Callback done;
+        Clock::time_point queued;
+    };
+    struct Connection
+    {
+        MYSQL *conn = nullptr;
+        bool busy = false;
+        Query query;
+    };
+    DbConfig cfg;
+    vector<Connection> connections;
+    deque<Query> pending;
+
+    void complete(Connection &c, bool ok)
+    {
+        Query query = move(c.query);
+        c.busy = false;
+        uint64_t affected = 0;
+        if (ok)
+            affected = mysql_affected_rows(c.conn);
+        else
+            LOG(Error) << "async query failed: " << mysql_error(c.conn);
+        query.time->observe(Clock::now() - query.queued);
+        if (query.done)
+            query.done(ok, affected);
+    }
+
+public:
+    AsyncDb(const DbConfig &cfg, int size) : cfg(cfg), connections(max(1, size))
+    {
+        for (Connection &c : connections)
+            c.conn = init_db(cfg);
+    }
+    ~AsyncDb()
+    {
+        // Незавершённый запрос сервер доделает сам; соединение просто закрывается
+        for (Connection &c : connections)
+        {
+            if (c.conn)
+                mysql_close(c.conn);
+        }
+    }
+    AsyncDb(const AsyncDb &) = delete;
+    AsyncDb &operator=(const AsyncDb &) = delete;
+
+    // Ставит запрос в очередь; выполняется он из perform()
+    void submit(Histogram &time, SqlBuilder build, Callback done = nullptr)
+    {
+        pending.push_back({move(build), {}, &time, move(done), Clock::now()});
+        perform();
+    }
+
+    // Строковый литерал SQL в кавычках, экранированный для соединения conn
+    static string quote(MYSQL *conn, string_view value)
+    {
+        string out(value.size() * 2 + 3, '\0');
+        out[0] = '\'';
+        unsigned long length = mysql_real_escape_string(conn, &out[1], value.data(), value.size());
+        out.resize(length + 1);
+        out += '\'';
+        return out;
+    }
+
+    // Продвигает запросы в полёте и отправляет ожидающие на освободившиеся соединения
+    void perform() override
+    {
+        for (Connection &c : connections)
+        {
+            if (!c.busy)
+            {
+                if (pending.empty())
+                    continue;
+                c.query = move(pending.front());
+                pending.pop_front();
+                c.query.sql = c.query.build(c.conn);
+                c.busy = true;
+            }
+            net_async_status status = mysql_real_query_nonblocking(c.conn, c.query.sql.data(), c.query.sql.size());
+            if (status != NET_ASYNC_NOT_READY)
+                complete(c, status != NET_ASYNC_ERROR);
+        }
+    }
+
+    // Добавляет в fds сокеты соединений, ждущих ответа сервера, и возвращает время ожидания.
+    // Отправка большого запроса тоже может ждать (готовности сокета к записи), поэтому при
+    // запросах в полёте ожидание ограничено 50 мс
+    long wait_fds(vector<curl_waitfd> &fds, long wait_ms) const override
+    {
+        for (const Connection &c : connections)
+        {
+            if (!c.busy)
+                continue;
+            fds.push_back({(curl_socket_t)c.conn->net.fd, CURL_WAIT_POLLIN, 0});
+            wait_ms = min(wait_ms, 50L);
+        }
+        return wait_ms;
+    }
+
+    bool idle() const
+    {
+        if (!pending.empty())
+            return false;
+        for (const Connection &c : connections)
+        {
+            if (c.busy)
+                return false;
+        }
+        return true;
+    }
+
+    // Ждёт завершения всех запросов (вне цикла Fetcher)
+    void drain()
+    {
+        vector<curl_waitfd> fds;
+        while (perform(), !idle())
+        {
+            fds.clear();
+            long wait_ms = wait_fds(fds, 1000);
+            vector<pollfd> polled;
+            for (const curl_waitfd &fd : fds)
+                polled.push_back({fd.fd, POLLIN, 0});
+            poll(polled.data(), polled.size(), (int)wait_ms);
+        }
+    }
+
+    // Переподключает соединения, которые сервер закрыл (долгие паузы в режиме демона)
+    void ensure_connected()
+    {
+        drain();
+        for (Connection &c : connections)
+        {
+            if (c.conn && mysql_ping(c.conn) == 0)
+                continue;
+            LOG(Warning) << "Lost DB connection, reconnecting: " << (c.conn ? mysql_error(c.conn) : "");
+            if (c.conn)
+                mysql_close(c.conn);
+            c.conn = nullptr;
+            c.conn = init_db(cfg);
+        }
+    }
+};
+
+// Сколько URL вставляется одним выражением
+const size_t DB_BATCH = 16;
+
+// --- Локальный индекс уже обработанных URL ---
+// 64-битные отпечатки URL в открытой хэш-таблице, лежащей в файле, отображённом в память.
+// Проверка "видели ли мы этот URL" не ходит в БД; файл переживает перезапуск процесса.
+class SeenIndex
+{
+private:
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t capacity; // число слотов, степень двойки
+        uint64_t count;
+        uint64_t reserved;
+    };
+    static constexpr uint64_t MAGIC = 0x3158444e4e454553ULL; // "SEENNDX1"
+    static constexpr uint64_t INITIAL_CAPACITY = 1 << 16;
+
+    string path;
+    int fd = -1;
+    Header *header = nullptr;
+    bool created = false;
+    mutable mutex mtx;
+
+    static size_t file_size(uint64_t capacity)
+    {
+        return sizeof(Header) + capacity * sizeof(uint64_t);
+    }
+    static Header *map_file(int fd, size_t size)
+    {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            throw runtime_error("Failed to mmap seen-URL index");
+        return static_cast<Header *>(p);
+    }
+    // Делает из файла fd пустой индекс на capacity слотов
+    static Header *create(int fd, uint64_t capacity)
+    {
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, file_size(capacity)) != 0)
+            throw runtime_error("Failed to resize seen-URL index");
+        Header *h = map_file(fd, file_size(capacity));
+        h->magic = MAGIC;
+        h->capacity = capacity;
+        h->count = 0;
+        return h;
+    }
+    // Добавляет отпечаток, возвращает false если он уже был
+    static bool place(Header *h, uint64_t fp)
+    {
+        uint64_t mask = h->capacity - 1;
+        uint64_t *table = reinterpret_cast<uint64_t *>(h + 1);
+        for (uint64_t i = fp & mask;; i = (i + 1) & mask)
+        {
+            if (table[i] == fp)
+                return false;
+            if (table[i] == 0)
+            {
+                table[i] = fp;
+                h->count++;
+                return true;
+            }
+        }
+    }
+    // Переносит отпечатки в файл вдвое большего размера и атомарно подменяет им старый
+    void grow()
+    {
+        string tmp_path = path + ".tmp";
+        int tmp_fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (tmp_fd < 0)
+            throw runtime_error("Failed to create " + tmp_path);
+        Header *bigger = create(tmp_fd, header->capacity * 2);
+        const uint64_t *table = reinterpret_cast<const uint64_t *>(header + 1);
+        for (uint64_t i = 0; i < header->capacity; ++i)
+        {
+            if (table[i])
+                place(bigger, table[i]);
+        }
+        msync(bigger, file_size(bigger->capacity), MS_SYNC);
+        if (rename(tmp_path.c_str(), path.c_str()) != 0)
+            LOG(Error) << "Failed to replace seen-URL index " << path;
+        munmap(header, file_size(header->capacity));
+        close(fd);
+        header = bigger;
+        fd = tmp_fd;
+    }
+
+public:
+    explicit SeenIndex(const string &path) : path(path)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw runtime_error("Failed to open seen-URL index: " + path);
+
+        Header stored{};
+        struct stat info;
+        bool valid = fstat(fd, &info) == 0 &&
+                     pread(fd, &stored, sizeof(stored), 0) == (ssize_t)sizeof(stored) &&
+                     stored.magic == MAGIC && stored.capacity &&
+                     (stored.capacity & (stored.capacity - 1)) == 0 &&
+                     (size_t)info.st_size == file_size(stored.capacity);
+        if (valid)
+        {
+            header = map_file(fd, file_size(stored.capacity));
+        }
+        else
+        {
+            header = create(fd, INITIAL_CAPACITY);
+            created = true;
+        }
+    }
+    ~SeenIndex()
+    {
+        msync(header, file_size(header->capacity), MS_ASYNC);
+        munmap(header, file_size(header->capacity));
+        close(fd);
+    }
+    SeenIndex(const SeenIndex &) = delete;
+    SeenIndex &operator=(const SeenIndex &) = delete;
+
+    // URL длиннее ключа таблицы articles берётся в виде url_key, как и при прогреве из БД
+    static uint64_t fingerprint(const string &url)
+    {
+        if (url.size() > URL_KEY_MAX)
+            return fingerprint(url_key(url));
+        uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+        for (unsigned char c : url)
+        {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        h ^= h >> 33; // перемешивание младших бит для индекса слота
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h ? h : 1; // 0 обозначает пустой слот
+    }
+
+    // true, если индекс только что создан и его нужно заполнить из БД
+    bool is_new() const { return created; }
+
+    size_t size() const
+    {
+        lock_guard<mutex> lock(mtx);
+        return header->count;
+    }
+
+    bool contains(const string &url) const
+    {
+        uint64_t fp = fingerprint(url);
+        lock_guard<mutex> lock(mtx);
+        uint64_t mask = header->capacity - 1;
+        const uint64_t *table = reinterpret_cast<const uint64_t *>(header + 1);
+        for (uint64_t i = fp & mask; table[i]; i = (i + 1) & mask)
+        {
+            if (table[i] == fp)
+                return true;
+        }
+        return false;
+    }
+
+    void insert(const string &url)
+    {
+        uint64_t fp = fingerprint(url);
+        lock_guard<mutex> lock(mtx);
+        if ((header->count + 1) * 2 > header->capacity)
+            grow();
+        place(header, fp);
+    }
+};
+
+// Заполняет свежесозданный индекс всеми URL из таблицы articles
+bool warm_seen_index(SeenIndex &seen, Db &db)
+{
+    LOG(Info) << "Warming seen-URL index from DB...";
+    vector<string> urls;
+    {
+        ScopedTimer timer(metrics.histogram("parser_db_seconds", {{"query", "select_urls"}}));
+        Statement &st = db.prepare("SELECT url FROM articles");
+        if (!st.execute())
+            return false;
+        urls = st.fetch_strings();
+    }
+    for (const string &url : urls)
+        seen.insert(url);
+    LOG(Info) << "Seen-URL index holds " << seen.size() << " URLs";
+    return true;
+}
+
+// Отмечает обработанные URL в таблице articles многострочными INSERT IGNORE по DB_BATCH строк.
+// Запросы не блокируют поток сайта: они расходятся по соединениям AsyncDb и выполняются из
+// цикла Fetcher, пока загружаются остальные статьи; вызывающий дожидается их через db.drain()
+void insert_urls(AsyncDb &db, const vector<string> &urls)
+{
+    LOG(Debug) << "Inserting " << urls.size() << " URLs in DB";
+    static Histogram &db_time = metrics.histogram("parser_db_seconds", {{"query", "insert_urls"}});
+    for (size_t offset = 0; offset < urls.size(); offset += DB_BATCH)
+    {
+        vector<string> keys;
+        for (size_t i = offset; i < min(offset + DB_BATCH, urls.size()); ++i)
+            keys.push_back(url_key(urls[i]));
+        db.submit(db_time, [keys = move(keys)](MYSQL *conn)
+                  {
+                      string sql = "INSERT IGNORE INTO articles(url) VALUES ";
+                      for (size_t i = 0; i < keys.size(); ++i)
+                          sql += (i ? ",(" : "(") + AsyncDb::quote(conn, keys[i]) + ")";
+                      return sql; });
+    }
+}
+
+// --- Отпечатки содержимого статей ---
+// hash — xxHash64 нормализованного текста (слова в нижнем регистре через один пробел):
+// совпадает у перезагруженной статьи и у той же статьи под другим URL.
+// simhash — 64-битный SimHash по тройкам слов: у почти одинаковых текстов (перепечатки
+// с другой подписью или врезкой) отличается в нескольких битах.
+struct ContentFingerprint
+{
+    uint64_t hash = 0;
+    uint64_t simhash = 0;
+};
+
+// Расстояние Хэмминга, до которого тексты считаются одной статьёй. Четыре 16-битные полосы
+// SimHash проиндексированы: при расстоянии до 3 хотя бы одна полоса совпадает целиком
+const int NEAR_DUPLICATE_BITS = 3;
+
+ContentFingerprint fingerprint_content(string_view text)
+{
+    string normalized;
+    normalized.reserve(text.size());
+    vector<pair<size_t, size_t>> words; // начало и длина слова в normalized
+    for (size_t i = 0; i < text.size();)
+    {
+        // Буквы и цифры ASCII и любые байты UTF-8 — часть слова, остальное — разделитель
+        auto is_word = [](unsigned char c)
+        { return isalnum(c) || c >= 0x80; };
+        while (i < text.size() && !is_word(text[i]))
+            ++i;
+        size_t start = i;
+        while (i < text.size() && is_word(text[i]))
+            ++i;
+        if (i == start)
+            break;
+        if (!normalized.empty())
+            normalized += ' ';
+        words.emplace_back(normalized.size(), i - start);
+        for (size_t j = start; j < i; ++j)
+            normalized += (char)tolower((unsigned char)text[j]);
+    }
+
+    ContentFingerprint fp;
+    fp.hash = xxhash64(normalized.data(), normalized.size());
+
+    const size_t SHINGLE = 3;
+    int votes[64] = {};
+    size_t shingles = words.size() >= SHINGLE ? words.size() - SHINGLE + 1 : min<size_t>(words.size(), 1);
+    for (size_t i = 0; i < shingles; ++i)
+    {
+        const auto &last = words[min(i + SHINGLE, words.size()) - 1];
+        uint64_t h = xxhash64(normalized.data() + words[i].first, last.first + last.second - words[i].first);
+        for (int bit = 0; bit < 64; ++bit)
+            votes[bit] += (h >> bit) & 1 ? 1 : -1;
+    }
+    for (int bit = 0; bit < 64; ++bit)
+    {
+        if (votes[bit] > 0)
+            fp.simhash |= 1ULL << bit;
+    }
+    return fp;
+}
+
+// URL уже сохранённой статьи с тем же или почти тем же текстом; пустая строка — дубликатов нет.
+// Сервер проверяет BIT_COUNT только у строк, совпавших по одной из полос. Ошибка запроса бросается.
+string find_duplicate(Db &db, const ContentFingerprint &fp)
+{
+    static Histogram &db_time = metrics.histogram("parser_db_seconds", {{"query", "find_duplicate"}});
+    ScopedTimer timer(db_time);
+    Statement &st = db.prepare(
+        "SELECT url FROM article_fingerprints WHERE content_hash = ? "
+        "OR ((band0 = ? OR band1 = ? OR band2 = ? OR band3 = ?) AND BIT_COUNT(simhash ^ ?) <= " +
+        to_string(NEAR_DUPLICATE_BITS) + ") LIMIT 1");
+    st.bind(0, fp.hash);
+    for (int band = 0; band < 4; ++band)
+        st.bind(1 + band, (fp.simhash >> (16 * band)) & 0xffff);
+    st.bind(5, fp.simhash);
+    if (!st.execute())
+        throw runtime_error("Duplicate lookup failed");
+    vector<string> rows = st.fetch_strings();
+    return rows.empty() ? "" : rows[0];
+}
+
+// Записывает отпечаток статьи; false, если такой же текст только что сохранил другой поток.
+// Ошибка запроса бросается
+bool claim_fingerprint(Db &db, const ContentFingerprint &fp, const string &url)
+{
+    static Histogram &db_time = metrics.histogram("parser_db_seconds", {{"query", "claim_fingerprint"}});
+    ScopedTimer timer(db_time);
+    Statement &st = db.prepare(
+        "INSERT IGNORE INTO article_fingerprints (content_hash, simhash, band0, band1, band2, band3, url) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?)");
+    st.bind(0, fp.hash);
+    st.bind(1, fp.simhash);
+    for (int band = 0; band < 4; ++band)
+        st.bind(2 + band, (fp.simhash >> (16 * band)) & 0xffff);
+    st.bind(6, url);
+    if (!st.execute())
+        throw runtime_error("Fingerprint insert failed");
+    return st.affected_rows() > 0;
+}
+
+// --- Нормализация текста статьи перед записью в wp_posts ---
+// Текст из xmlNodeGetContent несёт отступы и переводы строк разметки. За один проход:
+// серии пробельных символов (включая NBSP) схлопываются в один пробел, а если в серии
+// был перевод строки — в один '\n'; управляющие символы, U+200B..U+200D и BOM удаляются,
+// пробелы по краям отбрасываются. Сущности, оставшиеся в тексте после libxml2 (исходник
+// экранирован дважды: "&amp;nbsp;", "&amp;#8217;"), раскрываются. Короткие строки-призывы
+// ("Share this article", "Follow us on ...") выбрасываются целиком, как только строка
+// закончилась. Попутно отмечается граница слова для анонса.
+struct NormalizedText
+{
+    string content;
+    string excerpt; // первые слова content одной строкой, не длиннее EXCERPT_BYTES
+};
+
+const size_t EXCERPT_BYTES = 300;
+const size_t SLUG_BYTES = 200; // длина wp_posts.post_name
+
+// Кнопки и призывы вокруг статьи, а не её текст. Строка стирается, только если она целиком
+// состоит из такой фразы (без учёта регистра ASCII) и, возможно, знаков препинания, стрелок
+// и ссылки: "Read more »", "Share this:", "Read more: https://…". Фраза в начале обычного
+// предложения ("Subscribe-based malware…", "Related: the CVE affects…") остаётся в тексте
+const size_t BOILERPLATE_LINE_BYTES = 160;
+const char *const BOILERPLATE_PHRASES[] = {
+    "share", "share this", "share this article", "share this post", "follow us", "subscribe",
+    "subscribe now", "sign up", "click here", "read more", "read also", "also read", "related",
+    "related articles", "related posts", "related stories", "advertisement", "you may also like",
+    "you might also like", "don't miss",
+};
+
+// Длина знака препинания или стрелки в начале s (ASCII или » › → … – —); 0, если это не он
+size_t boilerplate_mark(string_view s)
+{
+    static const char *const marks[] = {"\xc2\xbb", "\xe2\x80\xba", "\xe2\x86\x92", "\xe2\x80\xa6",
+                                        "\xe2\x80\x93", "\xe2\x80\x94"};
+    if (s.empty())
+        return 0;
+    if (ispunct((unsigned char)s[0]) || s[0] == ' ')
+        return 1;
+    for (const char *mark : marks)
+    {
+        size_t len = strlen(mark);
+        if (s.size() >= len && s.compare(0, len, mark) == 0)
+            return len;
+    }
+    return 0;
+}
+
+bool is_boilerplate_line(string_view line)
+{
+    if (line.size() > BOILERPLATE_LINE_BYTES)
+        return false;
+    for (const char *phrase : BOILERPLATE_PHRASES)
+    {
+        size_t len = strlen(phrase);
+        if (line.size() < len || strncasecmp(line.data(), phrase, len) != 0)
+            continue;
+        string_view rest = line.substr(len);
+        // После фразы — только знаки препинания и стрелки, затем, возможно, одна ссылка
+        if (!rest.empty() && isalnum((unsigned char)rest[0]))
+            continue; // "Subscribers", "Shared"
+        while (size_t mark = boilerplate_mark(rest))
+            rest.remove_prefix(mark);
+        if (rest.empty())
+            return true;
+        if ((rest.compare(0, 7, "http://") == 0 || rest.compare(0, 8, "https://") == 0) &&
+            rest.find(' ') == string_view::npos)
+            return true;
+    }
+    return false;
+}
+
+// Разбирает сущность после '&': "name;", "#NNN;" или "#xHH;". Возвращает длину без '&'
+// или 0, если это не сущность (тогда '&' остаётся в тексте). Любая сущность длиннее
+// своей записи в UTF-8, поэтому результат нормализации не длиннее исходного текста
+size_t parse_entity(const char *p, size_t n, uint32_t &code_point)
+{
+    if (n > 0 && p[0] == '#')
+    {
+        bool hex = n > 1 && (p[1] == 'x' || p[1] == 'X');
+        size_t i = hex ? 2 : 1;
+        uint32_t value = 0;
+        size_t digits = 0;
+        for (; i < n && digits < 7; ++i, ++digits)
+        {
+            int digit = isdigit((unsigned char)p[i]) ? p[i] - '0'
+                        : hex && isxdigit((unsigned char)p[i]) ? tolower((unsigned char)p[i]) - 'a' + 10
+                                                              : -1;
+            if (digit < 0)
+                break;
+            value = value * (hex ? 16 : 10) + digit;
+        }
+        if (!digits || i >= n || p[i] != ';' || value == 0 || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff))
+            return 0;
+        code_point = value;
+        return i + 1;
+    }
+    static const pair<const char *, uint32_t> named[] = {
+        {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''}, {"nbsp", 0xa0},
+        {"ndash", 0x2013}, {"mdash", 0x2014}, {"lsquo", 0x2018}, {"rsquo", 0x2019},
+        {"ldquo", 0x201c}, {"rdquo", 0x201d}, {"hellip", 0x2026}, {"copy", 0xa9},
+    };
+    for (const auto &entity : named)
+    {
+        size_t len = strlen(entity.first);
+        if (n > len && memcmp(p, entity.first, len) == 0 && p[len] == ';')
+        {
+            code_point = entity.second;
+            return len + 1;
+        }
+    }
+    return 0;
+}
+
+// Особые байты: <= 0x20, '&', DEL и первые байты NBSP (C2 A0), U+200B..U+200D, U+2028/2029
+// (E2 80 xx) и BOM (EF BB BF). Всё остальное, в том числе кириллица (D0/D1), копируется как есть
+inline bool is_special_byte(unsigned char c)
+{
+    return c <= 0x20 || c == '&' || c == 0x7f || c == 0xc2 || c == 0xe2 || c == 0xef;
+}
+
+#if defined(__x86_64__)
+// Маска особых байтов блока: бит k — байт p[k]. SSE2 есть на любом x86-64
+uint32_t special_mask_sse2(const char *p)
+{
+    const __m128i space = _mm_set1_epi8(0x20), amp = _mm_set1_epi8('&'), del = _mm_set1_epi8(0x7f),
+                  c2 = _mm_set1_epi8((char)0xc2), e2 = _mm_set1_epi8((char)0xe2), ef = _mm_set1_epi8((char)0xef);
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    // беззнаковое x <= 0x20 <=> max(x, 0x20) == 0x20
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, space), space), _mm_cmpeq_epi8(x, amp)),
+                                   _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, del), _mm_cmpeq_epi8(x, c2)),
+                                                _mm_or_si128(_mm_cmpeq_epi8(x, e2), _mm_cmpeq_epi8(x, ef))));
+    return (uint32_t)_mm_movemask_epi8(special);
+}
+
+// AVX2 — по 32 байта; собирается с target("avx2") и вызывается, только если процессор
+// его поддерживает, так что бинарник без -mavx2 работает везде
+__attribute__((target("avx2"))) uint32_t special_mask_avx2(const char *p)
+{
+    const __m256i space = _mm256_set1_epi8(0x20), amp = _mm256_set1_epi8('&'), del = _mm256_set1_epi8(0x7f),
+                  c2 = _mm256_set1_epi8((char)0xc2), e2 = _mm256_set1_epi8((char)0xe2), ef = _mm256_set1_epi8((char)0xef);
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, space), space), _mm256_cmpeq_epi8(x, amp)),
+                                      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, del), _mm256_cmpeq_epi8(x, c2)),
+                                                      _mm256_or_si256(_mm256_cmpeq_epi8(x, e2), _mm256_cmpeq_epi8(x, ef))));
+    return (uint32_t)_mm256_movemask_epi8(special);
+}
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+// Лучший набор инструкций этого процессора; определяется один раз
+SimdLevel simd_level()
+{
+#if defined(__x86_64__)
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::Avx2 : SimdLevel::Sse2;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char *simd_level_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Avx2:
+        return "avx2";
+    case SimdLevel::Sse2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+// Основной цикл: текст идёт блоками по Width байт, Mask отмечает в блоке особые байты.
+// Между ними байты копируются кусками; каждый особый байт разбирается один раз, блок не
+// перечитывается. Набор инструкций выбирается шаблоном один раз на текст; при Width == 0
+// (другие архитектуры, эталон в --bench) весь текст проходит скалярный цикл.
+template <size_t Width, uint32_t (*Mask)(const char *)>
+void normalize_text_impl(string_view text, NormalizedText &result)
+{
+    const char *p = text.data();
+    const size_t n = text.size();
+    string &out = result.content;
+    out.resize(n); // результат не длиннее исходного текста
+    char *const begin = &out[0];
+    char *dst = begin;
+    char pending = 0;       // отложенный разделитель: 0, ' ' или '\n'
+    size_t excerpt_end = 0; // конец последнего слова, уместившегося в анонс
+    size_t line_start = 0;  // начало текущей строки в out
+
+    // Строка закончилась: если это призыв, она стирается вместе с предшествующим '\n'
+    auto end_line = [&]
+    {
+        if (!is_boilerplate_line(string_view(begin + line_start, dst - begin - line_start)))
+            return;
+        dst = begin + line_start;
+        if (dst != begin)
+            --dst;
+        line_start = dst - begin; // предыдущая строка уже проверена
+        excerpt_end = min(excerpt_end, (size_t)(dst - begin));
+    };
+
+    // Перед очередным словом выводится отложенный разделитель
+    auto separate = [&]
+    {
+        if (!pending)
+            return;
+        if (pending == '\n')
+            end_line();
+        if (dst != begin)
+        {
+            if ((size_t)(dst - begin) <= EXCERPT_BYTES)
+                excerpt_end = dst - begin;
+            *dst++ = pending;
+            if (pending == '\n')
+                line_start = dst - begin;
+        }
+        pending = 0;
+    };
+
+    auto copy = [&](size_t from, size_t to)
+    {
+        separate();
+        memcpy(dst, p + from, to - from);
+        dst += to - from;
+    };
+
+    // Символ раскрытой сущности: пробельные — разделитель, невидимые — пропускаются
+    auto emit = [&](uint32_t cp)
+    {
+        if (cp == ' ' || cp == '\t' || cp == '\r' || cp == 0xa0)
+        {
+            if (!pending)
+                pending = ' ';
+            return;
+        }
+        if (cp == '\n' || cp == 0x2028 || cp == 0x2029)
+        {
+            pending = '\n';
+            return;
+        }
+        if (cp < 0x20 || cp == 0x7f || (cp >= 0x200b && cp <= 0x200d) || cp == 0xfeff)
+            return;
+        separate();
+        if (cp < 0x80)
+            *dst++ = (char)cp;
+        else if (cp < 0x800)
+        {
+            *dst++ = (char)(0xc0 | (cp >> 6));
+            *dst++ = (char)(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            *dst++ = (char)(0xe0 | (cp >> 12));
+            *dst++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+            *dst++ = (char)(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            *dst++ = (char)(0xf0 | (cp >> 18));
+            *dst++ = (char)(0x80 | ((cp >> 12) & 0x3f));
+            *dst++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+            *dst++ = (char)(0x80 | (cp & 0x3f));
+        }
+    };
+
+    // Разбор особого байта p[i]; возвращает, сколько байтов съедено
+    auto special = [&](size_t i) -> size_t
+    {
+        unsigned char c = p[i];
+        unsigned char c1 = i + 1 < n ? p[i + 1] : 0, c2 = i + 2 < n ? p[i + 2] : 0;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+        {
+            if (!pending)
+                pending = ' ';
+            return 1;
+        }
+        if (c == '\n')
+        {
+            pending = '\n';
+            return 1;
+        }
+        if (c < 0x20 || c == 0x7f)
+            return 1; // управляющий символ — выбрасываем
+        if (c == '&')
+        {
+            uint32_t cp = 0, inner = 0;
+            size_t len = parse_entity(p + i + 1, n - i - 1, cp);
+            if (!len)
+            {
+                copy(i, i + 1); // '&' в тексте ("AT&T")
+                return 1;
+            }
+            size_t total = 1 + len;
+            // "&amp;nbsp;" — экранирование в несколько слоёв снимается до конца
+            while (cp == '&' && (len = parse_entity(p + i + total, n - i - total, inner)))
+            {
+                cp = inner;
+                total += len;
+            }
+            emit(cp);
+            return total;
+        }
+        if (c == 0xc2 && c1 == 0xa0)
+        {
+            if (!pending)
+                pending = ' ';
+            return 2; // NBSP
+        }
+        if (c == 0xe2 && c1 == 0x80 && (c2 == 0xa8 || c2 == 0xa9))
+        {
+            pending = '\n';
+            return 3; // разделители строк и абзацев Unicode
+        }
+        if ((c == 0xe2 && c1 == 0x80 && c2 >= 0x8b && c2 <= 0x8d) || (c == 0xef && c1 == 0xbb && c2 == 0xbf))
+            return 3; // пробел нулевой ширины, ZWNJ, ZWJ, BOM
+        copy(i, i + 1); // обычный символ, начавшийся с особого байта
+        return 1;
+    };
+
+    size_t i = 0;
+    while (Width && i + Width <= n)
+    {
+        size_t base = i;
+        uint32_t mask = Mask(p + base);
+        while (mask)
+        {
+            size_t pos = base + __builtin_ctz(mask);
+            if (pos >= i)
+            {
+                if (pos > i)
+                    copy(i, pos);
+                i = pos + special(pos);
+            }
+            mask &= mask - 1;
+        }
+        if (i < base + Width)
+        {
+            copy(i, base + Width);
+            i = base + Width;
+        }
+    }
+    while (i < n)
+    {
+        size_t plain = i;
+        while (plain < n && !is_special_byte(p[plain]))
+            ++plain;
+        if (plain > i)
+            copy(i, plain);
+        i = plain < n ? plain + special(plain) : n;
+    }
+    end_line();
+    out.resize(dst - begin);
+
+    if (out.size() <= EXCERPT_BYTES)
+        excerpt_end = out.size();
+    else if (excerpt_end == 0)
+    {
+        // Первое же слово длиннее анонса — режем по границе символа UTF-8
+        excerpt_end = EXCERPT_BYTES;
+        while (excerpt_end > 0 && ((unsigned char)out[excerpt_end] & 0xc0) == 0x80)
+            --excerpt_end;
+    }
+    result.excerpt.assign(out, 0, excerpt_end);
+    replace(result.excerpt.begin(), result.excerpt.end(), '\n', ' ');
+    if (excerpt_end < out.size())
+        result.excerpt += "\xe2\x80\xa6"; // многоточие
+}
+
+void normalize_text(string_view text, NormalizedText &result, SimdLevel level = simd_level())
+{
+#if defined(__x86_64__)
+    if (level == SimdLevel::Avx2)
+        return normalize_text_impl<32, special_mask_avx2>(text, result);
+    if (level == SimdLevel::Sse2)
+        return normalize_text_impl<16, special_mask_sse2>(text, result);
+#endif
+    normalize_text_impl<0, nullptr>(text, result);
+}
+
+// post_name для WordPress: буквы и цифры ASCII в нижнем регистре, остальные символы ASCII —
+// разделитель '-' (серии схлопываются), символы UTF-8 — в процентной записи, как у
+// sanitize_title. Некорректные последовательности UTF-8 отбрасываются, длина — до SLUG_BYTES
+// без разрыва символа. Если заголовок — URL, slug строится из последнего сегмента пути
+// без расширения: у новостных сайтов это обычно уже готовый slug статьи.
+string make_slug(string_view title)
+{
+    string decoded;
+    if (title.find("://") != string_view::npos)
+    {
+        size_t host = title.find("://") + 3;
+        string_view path = title.substr(0, title.find_first_of("?#", host));
+        while (path.size() > host && path.back() == '/')
+            path.remove_suffix(1);
+        size_t slash = path.rfind('/');
+        if (slash != string_view::npos && slash >= host)
+        {
+            path = path.substr(slash + 1);
+            size_t dot = path.rfind('.');
+            if (dot != string_view::npos && dot > 0)
+                path = path.substr(0, dot);
+            title = path;
+        }
+        if (char *unescaped = xmlURIUnescapeString(title.data(), (int)title.size(), nullptr))
+        {
+            decoded = unescaped;
+            xmlFree(unescaped);
+            title = decoded;
+        }
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    string slug;
+    slug.reserve(min(title.size() * 3, SLUG_BYTES));
+    for (size_t i = 0; i < title.size();)
+    {
+        unsigned char c = title[i];
+        if (c < 0x80)
+        {
+            if (isalnum(c))
+            {
+                if (slug.size() + 1 > SLUG_BYTES)
+                    break;
+                slug += (char)tolower(c);
+            }
+            else if (!slug.empty() && slug.back() != '-')
+                slug += '-';
+            ++i;
+            continue;
+        }
+        size_t len = c >= 0xf5 ? 0 : c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc2 ? 2 : 0;
+        bool valid = len && i + len <= title.size();
+        for (size_t k = 1; valid && k < len; ++k)
+            valid = ((unsigned char)title[i + k] & 0xc0) == 0x80;
+        if (!valid)
+        {
+            ++i;
+            continue;
+        }
+        if (slug.size() + 3 * len > SLUG_BYTES)
+            break;
+        for (size_t k = 0; k < len; ++k)
+        {
+            unsigned char b = title[i + k];
+            slug += '%';
+            slug += hex[b >> 4];
+            slug += hex[b & 0xf];
+        }
+        i += len;
+    }
+    while (!slug.empty() && slug.back() == '-')
+        slug.pop_back();
+    return slug;
+}
+
+// --- Вставка поста в wp_posts (WordPress) ---
+// content и excerpt — результат normalize_text
+void insert_wp_post(Db &db, const string &title, string_view content, const string &post_excerpt)
+{
+    // Значения по умолчанию для новых постов
+    string post_status = "draft";
+    string post_type = "post";
+    long long post_author = 1; // ID автора (можно изменить)
+
+    // Текущее время для post_date и post_date_gmt
+    time_t now = time(nullptr);
+    struct tm ltm;
+    gmtime_r(&now, &ltm);
+    char date_buf[32];
+    strftime(date_buf, sizeof(date_buf), "%Y-%m-%d %H:%M:%S", &ltm);
+    string post_date = date_buf;
+
+    string slug = make_slug(title);
+
+    static Histogram &db_time = metrics.histogram("parser_db_seconds", {{"query", "insert_wp_post"}});
+    ScopedTimer timer(db_time);
+
+    // guid обычно формируется как http://site/?p=<id>, но можно оставить пустым (WordPress сам обновит)
+    Statement &st = db.prepare(
+        "INSERT INTO wp_posts "
+        "(post_author, post_date, post_date_gmt, post_content, post_title, post_excerpt, post_status, comment_status, ping_status, post_name, post_type) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, 'open', 'open', ?, ?)");
+    st.bind(0, post_author);
+    st.bind(1, post_date);
+    st.bind(2, post_date);
+    st.bind(3, content);
+    st.bind(4, title);
+    st.bind(5, post_excerpt);
+    st.bind(6, post_status);
+    st.bind(7, slug);
+    st.bind(8, post_type);
+
+    if (!st.execute())
+        throw runtime_error("INSERT wp_posts failed");
+    LOG(Info) << "New WordPress post inserted: " << title;
+}
+
+// Абсолютные канонические адреса ссылок links со страницы base, прошедшие link_filter сайта
+vector<string> resolve_links(const vector<string> &links, const string &base, const SiteConfig &site)
+{
+    vector<string> absolute_links;
+
+    for (const string &link : links)
+    {
+        xmlChar *resolved = xmlBuildURI((const xmlChar *)link.c_str(), (const xmlChar *)base.c_str());
+        if (resolved)
+        {
+            string url = canonicalize_url((char *)resolved);
+            xmlFree(resolved);
+            // Необязательный фильтр адресов из config.json (link_filter)
+            if (site.link_filter.empty() || site.link_filter.matches(url))
+                absolute_links.push_back(move(url));
+        }
+    }
+
+    return absolute_links;
+}
+
+// --- Реализация функции find_article_links ---
+// link_pattern выбирает ссылки (элементы <a> или сразу атрибуты @href); относительные
+// адреса достраиваются от URL страницы-списка и проверяются фильтром link_filter.
+// base — адрес страницы-списка (по умолчанию первая страница сайта)
+vector<string> find_article_links(HtmlParser &parser, const SiteConfig &site, const string &base = "")
+{
+    return resolve_links(parser.find_attribute_values(*site.link_xpath, "href"), base.empty() ? site.url : base, site);
+}
+
+// --- Реализация функции process_article ---
+// Все найденные блоки контента собираются в буфер парсера за один обход дерева;
+// результат действителен, пока жив parser
+string_view process_article(const string &article_url, HtmlParser &parser, const CompiledXPath &content_xpath)
+{
+    string_view content = parser.extract_text(content_xpath);
+    if (content.empty())
+    {
+        LOG(Error) << "No content found for article: " << article_url;
+    }
+    return content;
+}
+
+// --- Архив статей ---
+// Вместо файла на каждую статью — несколько больших файлов, в которые только дописывают.
+// archive/segment-NNNNNN.dat — записи подряд: заголовок, URL, текст (сжатый zstd, если задано);
+// archive/segment-NNNNNN.idx — пары (хэш URL, смещение записи) для доступа по URL.
+// Сегмент, доросший до segment_bytes, закрывается и больше не меняется.
+struct ArchiveRecordHeader
+{
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t url_hash;    // xxhash64(url)
+    uint32_t url_size;
+    uint32_t stored_size; // размер текста в файле
+    uint32_t raw_size;    // размер текста после распаковки
+    uint32_t checksum;    // младшие 32 бита xxhash64 хранимого текста
+};
+static_assert(sizeof(ArchiveRecordHeader) == 32, "archive record header must stay 32 bytes");
+
+struct ArchiveIndexEntry
+{
+    uint64_t url_hash;
+    uint64_t offset;
+};
+
+const uint32_t ARCHIVE_MAGIC = 0x31435241; // "ARC1"
+const uint32_t ARCHIVE_ZSTD = 1;           // флаг: текст сжат zstd
+
+string archive_segment_path(const string &dir, uint32_t number, const char *ext)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/segment-%06u.%s", number, ext);
+    return dir + name;
+}
+
+// Номера сегментов в каталоге по возрастанию
+vector<uint32_t> archive_segments(const string &dir)
+{
+    vector<uint32_t> numbers;
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (dirent *entry = readdir(d))
+        {
+            unsigned number;
+            char ext[4];
+            if (sscanf(entry->d_name, "segment-%6u.%3s", &number, ext) == 2 && string(ext) == "dat")
+                numbers.push_back(number);
+        }
+        closedir(d);
+    }
+    sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+// Читает запись по смещению; false, если там нет целой корректной записи
+bool read_archive_record(int fd, uint64_t offset, ArchiveRecordHeader &header, string *url, string *content)
+{
+    if (pread(fd, &header, sizeof(header), offset) != (ssize_t)sizeof(header) || header.magic != ARCHIVE_MAGIC)
+        return false;
+    if (!url && !content)
+        return true;
+
+    string stored(header.url_size + header.stored_size, '\0');
+    if (pread(fd, &stored[0], stored.size(), offset + sizeof(header)) != (ssize_t)stored.size() ||
+        (uint32_t)xxhash64(stored.data() + header.url_size, header.stored_size) != header.checksum)
+        return false;
+    if (url)
+        url->assign(stored, 0, header.url_size);
+    if (!content)
+        return true;
+    if (!(header.flags & ARCHIVE_ZSTD))
+    {
+        content->assign(stored, header.url_size, string::npos);
+        return true;
+    }
+#ifdef HAVE_ZSTD
+    content->resize(header.raw_size);
+    size_t n = ZSTD_decompress(&(*content)[0], content->size(), stored.data() + header.url_size, header.stored_size);
+    return !ZSTD_isError(n) && n == header.raw_size;
+#else
+    throw runtime_error("Archive record is zstd-compressed, but the parser was built without zstd");
+#endif
+}
+
+class ArticleArchive
+{
+private:
+    string dir;
+    uint64_t segment_bytes;
+    int compression_level; // 0 — без сжатия
+    mutex mtx;
+    uint32_t segment = 0;
+    int data_fd = -1;
+    int index_fd = -1;
+    uint64_t data_size = 0;
+    bool dirty = false;
+
+    void close_segment()
+    {
+        if (data_fd < 0)
+            return;
+        sync_locked();
+        close(data_fd);
+        close(index_fd);
+        data_fd = index_fd = -1;
+    }
+
+    // Открывает сегмент на дозапись. После аварийного завершения хвост мог остаться
+    // недописанным: файл обрезается до последней целой записи, а индекс строится заново.
+    void open_segment(uint32_t number)
+    {
+        close_segment();
+        segment = number;
+        data_fd = open(archive_segment_path(dir, number, "dat").c_str(), O_RDWR | O_CREAT, 0644);
+        index_fd = open(archive_segment_path(dir, number, "idx").c_str(), O_RDWR | O_CREAT, 0644);
+        if (data_fd < 0 || index_fd < 0)
+            throw runtime_error("Failed to open archive segment in " + dir);
+
+        struct stat info;
+        fstat(data_fd, &info);
+        vector<ArchiveIndexEntry> entries;
+        ArchiveRecordHeader header;
+        uint64_t offset = 0;
+        while (offset + sizeof(header) <= (uint64_t)info.st_size && read_archive_record(data_fd, offset, header, nullptr, nullptr))
+        {
+            uint64_t next = offset + sizeof(header) + header.url_size + header.stored_size;
+            if (next > (uint64_t)info.st_size)
+                break;
+            entries.push_back({header.url_hash, offset});
+            offset = next;
+        }
+        data_size = offset;
+        struct stat index_info;
+        fstat(index_fd, &index_info);
+        if ((uint64_t)info.st_size != data_size || (size_t)index_info.st_size != entries.size() * sizeof(ArchiveIndexEntry))
+        {
+            LOG(Warning) << "Repairing archive segment " << number << ": " << entries.size() << " records kept";
+            if (ftruncate(data_fd, data_size) != 0 || ftruncate(index_fd, 0) != 0 ||
+                pwrite(index_fd, entries.data(), entries.size() * sizeof(ArchiveIndexEntry), 0) < 0)
+                throw runtime_error("Failed to repair archive segment " + to_string(number));
+        }
+        lseek(data_fd, 0, SEEK_END);
+        lseek(index_fd, 0, SEEK_END);
+    }
+
+    void sync_locked()
+    {
+        if (!dirty)
+            return;
+        fdatasync(data_fd);
+        fdatasync(index_fd);
+        dirty = false;
+    }
+
+public:
+    ArticleArchive(const string &dir, uint64_t segment_bytes, int compression_level)
+        : dir(dir), segment_bytes(max<uint64_t>(segment_bytes, 1 << 20)), compression_level(compression_level)
+    {
+        mkdir(dir.c_str(), 0755);
+#ifndef HAVE_ZSTD
+        if (this->compression_level > 0)
+        {
+            LOG(Warning) << "Built without zstd, archive records are stored uncompressed";
+            this->compression_level = 0;
+        }
+#endif
+        vector<uint32_t> segments = archive_segments(dir);
+        open_segment(segments.empty() ? 1 : segments.back());
+    }
+    ~ArticleArchive()
+    {
+        lock_guard<mutex> lock(mtx);
+        close_segment();
+    }
+    ArticleArchive(const ArticleArchive &) = delete;
+    ArticleArchive &operator=(const ArticleArchive &) = delete;
+
+    // Дописывает статью. На диск попадает при sync() — его вызывают пачками, а не на каждую запись
+    bool append(const string &url, string_view content)
+    {
+        string compressed;
+        string_view stored = content;
+        uint32_t flags = 0;
+#ifdef HAVE_ZSTD
+        if (compression_level > 0)
+        {
+            compressed.resize(ZSTD_compressBound(content.size()));
+            size_t n = ZSTD_compress(&compressed[0], compressed.size(), content.data(), content.size(), compression_level);
+            if (!ZSTD_isError(n) && n < content.size())
+            {
+                compressed.resize(n);
+                stored = compressed;
+                flags |= ARCHIVE_ZSTD;
+            }
+        }
+#endif
+        ArchiveRecordHeader header{ARCHIVE_MAGIC, flags, xxhash64(url.data(), url.size()), (uint32_t)url.size(),
+                                   (uint32_t)stored.size(), (uint32_t)content.size(),
+                                   (uint32_t)xxhash64(stored.data(), stored.size())};
+        iovec parts[3] = {{&header, sizeof(header)},
+                          {(void *)url.data(), url.size()},
+                          {(void *)stored.data(), stored.size()}};
+        size_t record_size = sizeof(header) + url.size() + stored.size();
+
+        lock_guard<mutex> lock(mtx);
+        if (data_size > 0 && data_size + record_size > segment_bytes)
+            open_segment(segment + 1);
+        ArchiveIndexEntry entry{header.url_hash, data_size};
+        if (writev(data_fd, parts, 3) != (ssize_t)record_size ||
+            write(index_fd, &entry, sizeof(entry)) != (ssize_t)sizeof(entry))
+        {
+            LOG(Error) << "Failed to append to archive segment " << segment << ": " << strerror(errno);
+            open_segment(segment); // обрезает частично записанную запись
+            return false;
+        }
+        data_size += record_size;
+        dirty = true;
+        LOG(Debug) << "Article archived: " << url << " (" << stored.size() << " of " << content.size() << " bytes)";
+        return true;
+    }
+
+    // fdatasync сегмента, если с прошлого раза что-то дописано
+    void sync()
+    {
+        lock_guard<mutex> lock(mtx);
+        sync_locked();
+    }
+};
+
+// Чтение архива: поиск статьи по URL через индексы сегментов и последовательный обход
+class ArchiveReader
+{
+private:
+    string dir;
+    vector<uint32_t> segments;
+    map<uint32_t, int> fds;
+    unordered_multimap<uint64_t, pair<uint32_t, uint64_t>> index; // хэш URL → (сегмент, смещение)
+
+    int segment_fd(uint32_t number)
+    {
+        auto it = fds.find(number);
+        if (it == fds.end())
+            it = fds.emplace(number, open(archive_segment_path(dir, number, "dat").c_str(), O_RDONLY)).first;
+        return it->second;
+    }
+
+public:
+    explicit ArchiveReader(const string &dir) : dir(dir), segments(archive_segments(dir))
+    {
+        for (uint32_t number : segments)
+        {
+            ifstream ifs(archive_segment_path(dir, number, "idx"), ios::binary);
+            ArchiveIndexEntry entry;
+            while (ifs.read((char *)&entry, sizeof(entry)))
+                index.emplace(entry.url_hash, make_pair(number, entry.offset));
+        }
+    }
+    ~ArchiveReader()
+    {
+        for (auto &[number, fd] : fds)
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+    ArchiveReader(const ArchiveReader &) = delete;
+    ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+    size_t size() const { return index.size(); }
+
+    // Последняя сохранённая версия статьи с этим URL
+    bool find(const string &url, string &content)
+    {
+        auto range = index.equal_range(xxhash64(url.data(), url.size()));
+        pair<uint32_t, uint64_t> latest{0, 0};
+        string found_url, found_content;
+        bool found = false;
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            ArchiveRecordHeader header;
+            if ((!found || it->second > latest) &&
+                read_archive_record(segment_fd(it->second.first), it->second.second, header, &found_url, &found_content) &&
+                found_url == url)
+            {
+                latest = it->second;
+                content = found_content;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Все записи по порядку сегментов; visit возвращает false, чтобы остановиться
+    void scan(const function<bool(const string &url, const string &content)> &visit)
+    {
+        for (uint32_t number : segments)
+        {
+            int fd = segment_fd(number);
+            ArchiveRecordHeader header;
+            string url, content;
+            for (uint64_t offset = 0; read_archive_record(fd, offset, header, &url, &content);
+                 offset += sizeof(header) + header.url_size + header.stored_size)
+            {
+                if (!visit(url, content))
+                    return;
+            }
+        }
+    }
+};
+
+DbConfig read_db_config(const Json::Value &db)
+{
+    DbConfig cfg;
+    cfg.host = db["host"].asString();
+    cfg.user = db["user"].asString();
+    cfg.password = db["password"].asString();
+    cfg.database = db["database"].asString();
+    cfg.port = db["port"].asUInt();
+    return cfg;
+}
+
+// options.pagination сайта; url — адрес первой страницы списка
+Pagination read_pagination(const Json::Value &options, const string &url)
+{
+    Pagination pagination;
+    string type = options.get("type", "").asString();
+    pagination.prefetch = max(1, options.get("prefetch", pagination.prefetch).asInt());
+    pagination.max_pages = options.get("max_pages", pagination.max_pages).asInt();
+    pagination.first_page = options.get("first_page", pagination.first_page).asInt();
+    pagination.url_template = options.get("url_template", "").asString();
+    if (type == "next_link")
+    {
+        pagination.type = Pagination::NextLink;
+    }
+    else if (type == "page_param")
+    {
+        pagination.type = Pagination::PageParam;
+        if (pagination.url_template.empty())
+        {
+            string param = options.get("param", "page").asString();
+            pagination.url_template = url + (url.find('?') == string::npos ? "?" : "&") + param + "={page}";
+        }
+    }
+    else if (type == "infinite_scroll")
+    {
+        // scroll_delay относится к прокрутке в браузере; паузу между запросами к хосту задаёт request_delay
+        pagination.type = Pagination::InfiniteScroll;
+        pagination.url_template = options.get("endpoint", pagination.url_template).asString();
+        pagination.json = options.get("format", "html").asString() == "json";
+        pagination.html_field = options.get("html_field", "").asString();
+        pagination.link_field = options.get("link_field", pagination.link_field).asString();
+        if (pagination.url_template.empty())
+        {
+            LOG(Warning) << "No pagination endpoint for infinite scroll on " << url << ", following next-page links instead";
+            pagination.type = Pagination::NextLink;
+        }
+    }
+    else
+    {
+        throw runtime_error("Unknown pagination type '" + type + "' for " + url);
+    }
+    if (pagination.type == Pagination::NextLink)
+        pagination.next_xpath = CompiledXPath::compile(options.get("next_xpath", "//link[@rel='next']/@href | //a[@rel='next']/@href").asString());
+    return pagination;
+}
+
+// --- Реализация функции read_config ---
+ParserConfig read_config(const string &config_file)
+{
+    ParserConfig config;
+    ifstream ifs(config_file);
+    if (!ifs)
+    {
+        throw runtime_error("Failed to open config file: " + config_file);
+    }
+
+    Json::Value root;
+    ifs >> root;
+
+    // Чтение конфигурации сайтов
+    for (const auto &site : root["sites"])
+    {
+        SiteConfig site_config;
+        site_config.url = site["url"].asString();
+        site_config.link_pattern = site["link_pattern"].asString();
+        site_config.content_block = site["content_block"].asString();
+        site_config.max_pages = site["max_pages"].asInt();
+        site_config.poll_interval = site.get("poll_interval", 0).asInt();
+        site_config.min_poll_interval = site.get("min_poll_interval", 0).asInt();
+        site_config.max_poll_interval = site.get("max_poll_interval", 0).asInt();
+
+        // Таймауты и повторы: секунды в конфиге, миллисекунды для curl
+        const Json::Value &options = site["options"];
+        if (options["pagination"].isObject())
+            site_config.pagination = read_pagination(options["pagination"], site_config.url);
+        FetchPolicy &policy = site_config.fetch_policy;
+        policy.connect_timeout_ms = (long)(options.get("connect_timeout", policy.connect_timeout_ms / 1000.0).asDouble() * 1000);
+        policy.timeout_ms = (long)(options.get("timeout", policy.timeout_ms / 1000.0).asDouble() * 1000);
+        policy.low_speed_limit = options.get("low_speed_limit", (Json::Int)policy.low_speed_limit).asInt();
+        policy.low_speed_time = options.get("low_speed_time", (Json::Int)policy.low_speed_time).asInt();
+        policy.retries = max(0, options.get("retries", policy.retries).asInt());
+        policy.backoff_ms = (long)(options.get("retry_backoff", policy.backoff_ms / 1000.0).asDouble() * 1000);
+        policy.user_agent = options.get("user_agent", policy.user_agent).asString();
+        const Json::Value &request_headers = options["request_headers"];
+        for (const string &name : request_headers.isObject() ? request_headers.getMemberNames() : vector<string>())
+            policy.headers.push_back(name + ": " + request_headers[name].asString());
+
+        // Ошибка в XPath обнаруживается здесь, а не посреди обработки сайта
+        site_config.link_xpath = CompiledXPath::compile(site_config.link_pattern);
+        site_config.content_xpath = CompiledXPath::compile(site_config.content_block);
+
+        // link_filter: регулярное выражение или список выражений для адресов статей
+        vector<string> filters;
+        const Json::Value &link_filter = site["link_filter"];
+        if (link_filter.isString())
+            filters.push_back(link_filter.asString());
+        for (const auto &filter : link_filter.isArray() ? link_filter : Json::Value(Json::arrayValue))
+            filters.push_back(filter.asString());
+        site_config.link_filter = RegexSet(filters);
+
+        config.sites.push_back(site_config);
+    }
+
+    // Чтение общей конфигурации парсера
+    config.output_dir = root["output_dir"].asString();
+    config.request_delay = root["request_delay"].asDouble();
+    config.site_workers = root.get("site_workers", config.site_workers).asInt();
+    config.debug_html = root.get("debug_html", config.debug_html).asBool();
+    config.poll_interval = root.get("poll_interval", config.poll_interval).asInt();
+    config.min_poll_interval = root.get("min_poll_interval", config.min_poll_interval).asInt();
+    config.max_poll_interval = root.get("max_poll_interval", config.max_poll_interval).asInt();
+    config.max_backoff = root.get("max_backoff", config.max_backoff).asInt();
+    config.extract_threads = root.get("extract_threads", config.extract_threads).asInt();
+    config.persist_threads = root.get("persist_threads", config.persist_threads).asInt();
+    config.queue_capacity = root.get("queue_capacity", config.queue_capacity).asInt();
+    config.max_parallel = root.get("max_parallel", config.max_parallel).asInt();
+    config.max_per_host = root.get("max_per_host", config.max_per_host).asInt();
+    config.metrics_port = root.get("metrics_port", config.metrics_port).asInt();
+    config.log_level = Logger::parse_level(root.get("log_level", "info").asString());
+    config.archive_segment_mb = root.get("archive_segment_mb", config.archive_segment_mb).asInt();
+    config.archive_compression = root.get("archive_compression", config.archive_compression).asInt();
+    config.breaker_threshold = root.get("breaker_threshold", config.breaker_threshold).asInt();
+    config.breaker_cooldown = root.get("breaker_cooldown", config.breaker_cooldown).asInt();
+    config.db_connections = root.get("db_connections", config.db_connections).asInt();
+
+    // Чтение конфигурации базы данных
+    config.db = read_db_config(root["db"]);
+
+    return config;
+}
+
+// --- Реализация функции ensure_dir_exists ---
+void ensure_dir_exists(const string &dir)
+{
+    struct stat info;
+
+    if (stat(dir.c_str(), &info) != 0)
+    {
+        LOG(Error) << "Cannot access " << dir;
+        return;
+    }
+
+    if (info.st_mode & S_IFDIR)
+    {
+        LOG(Debug) << "Directory exists: " << dir;
+    }
+    else
+    {
+        LOG(Error) << dir << " is not a directory";
+    }
+}
+
+// --- Прототипы функций ---
+string_view process_article(const string &article_url, HtmlParser &parser, const CompiledXPath &content_xpath);
+ParserConfig read_config(const string &config_file);
+void ensure_dir_exists(const string &dir);
+
+// --- Статьи одного прохода по сайту, идущие через конвейер ---
+// process_site ждёт, пока все его статьи не будут сохранены.
+// Чем закончилась обработка статьи
+enum class ArticleResult
+{
+    Saved,
+    Duplicate,
+    Empty, // страница получена, но текста в ней нет — повторять незачем
+    Gone,  // сервер ответил 4xx — страницы нет, повторять тоже незачем
+    Failed // загрузка или запись не удалась — статья повторится при следующем опросе
+};
+
+const char *article_result_name(ArticleResult result)
+{
+    switch (result)
+    {
+    case ArticleResult::Saved:
+        return "saved";
+    case ArticleResult::Duplicate:
+        return "duplicate";
+    case ArticleResult::Empty:
+        return "empty";
+    case ArticleResult::Gone:
+        return "gone";
+    default:
+        return "failed";
+    }
+}
+
+// Статьи одного опроса сайта. URL попадают в индекс просмотренных и в таблицу articles
+// только после того, как статья записана (или оказалась дубликатом либо пустой):
+// неудачные повторяются при следующем опросе.
+struct SiteBatch
+{
+    const SiteConfig &site;
+    mutex mtx;
+    condition_variable cv;
+    size_t pending = 0;
+    size_t saved = 0;
+    vector<string> processed; // URL, которые больше не нужно загружать
+    size_t recorded = 0;      // сколько из processed уже отправлено в индекс и БД
+
+    explicit SiteBatch(const SiteConfig &site) : site(site) {}
+
+    // Обработанные URL, ещё не отправленные в индекс и БД, если их набралось не меньше min_count
+    vector<string> take_unrecorded(size_t min_count)
+    {
+        lock_guard<mutex> lock(mtx);
+        if (processed.size() - recorded < max<size_t>(min_count, 1))
+            return {};
+        vector<string> urls(processed.begin() + recorded, processed.end());
+        recorded = processed.size();
+        return urls;
+    }
+
+    void add()
+    {
+        lock_guard<mutex> lock(mtx);
+        pending++;
+    }
+    void finish(const string &url, ArticleResult result)
+    {
+        lock_guard<mutex> lock(mtx);
+        pending--;
+        saved += result == ArticleResult::Saved;
+        if (result != ArticleResult::Failed)
+            processed.push_back(url);
+        cv.notify_all();
+    }
+    size_t wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        cv.wait(lock, [this]
+                { return pending == 0; });
+        return saved;
+    }
+};
+
+struct PipelineItem
+{
+    shared_ptr<SiteBatch> batch;
+    string url;
+    unique_ptr<HtmlParser> parser;
+    NormalizedText text; // извлечённый и нормализованный текст; parser после этого уже не нужен
+    chrono::steady_clock::time_point queued; // когда элемент встал в очередь стадии
+    ContentFingerprint fingerprint;
+    bool duplicate = false; // решение стадии записи, окончательно после коммита
+};
+
+// --- Конвейер обработки статей ---
+// загрузка + потоковый разбор (потоки сайтов) → извлечение текста → запись в архив и БД.
+// У каждой стадии свои потоки, между стадиями — ограниченные очереди.
+class Pipeline
+{
+private:
+    const ParserConfig &config;
+    ArticleArchive &archive;
+    BoundedQueue<PipelineItem> parsed;    // загрузка → извлечение
+    BoundedQueue<PipelineItem> extracted; // извлечение → запись
+    vector<thread> extractors;
+    vector<thread> persisters;
+    // Время ожидания в очередях показывает, какая стадия не успевает
+    Histogram &parsed_wait = metrics.histogram("parser_queue_wait_seconds", {{"queue", "extract"}});
+    Histogram &extracted_wait = metrics.histogram("parser_queue_wait_seconds", {{"queue", "persist"}});
+
+    void extract_loop()
+    {
+        PipelineItem item;
+        while (parsed.pop(item))
+        {
+            parsed_wait.observe(chrono::steady_clock::now() - item.queued);
+            LOG(Debug) << "Processing article: " << item.url;
+            {
+                ScopedTimer timer(metrics.histogram("parser_stage_seconds", {{"stage", "extract"}, {"site", item.batch->site.url}}));
+                normalize_text(process_article(item.url, *item.parser, *item.batch->site.content_xpath), item.text);
+                item.parser.reset();
+                item.fingerprint = fingerprint_content(item.text.content);
+            }
+            if (item.text.content.empty())
+            {
+                LOG(Warning) << "Empty content for article: " << item.url;
+                metrics.counter("parser_articles_total", {{"result", "empty"}, {"site", item.batch->site.url}})++;
+                item.batch->finish(item.url, ArticleResult::Empty);
+                continue;
+            }
+            shared_ptr<SiteBatch> batch = item.batch;
+            string url = item.url;
+            item.queued = chrono::steady_clock::now();
+            if (!extracted.push(move(item)))
+                batch->finish(url, ArticleResult::Failed);
+        }
+    }
+
+    // Записывает накопленные статьи одной транзакцией; исключение — откат всей транзакции
+    void persist_transaction(Db &db, vector<PipelineItem> &items)
+    {
+        db.ensure_connected(); // сервер мог закрыть соединение за время простоя демона
+        db.begin();
+        for (PipelineItem &item : items)
+        {
+            ScopedTimer timer(metrics.histogram("parser_stage_seconds", {{"stage", "persist"}, {"site", item.batch->site.url}}));
+            // Тот же или почти тот же текст уже сохранён (перепечатка, другой URL) — пропускаем
+            string duplicate_of = find_duplicate(db, item.fingerprint);
+            item.duplicate = !duplicate_of.empty() || !claim_fingerprint(db, item.fingerprint, item.url);
+            if (item.duplicate)
+            {
+                LOG(Info) << "Skipping duplicate of " << (duplicate_of.empty() ? "a concurrent article" : duplicate_of)
+                          << ": " << item.url;
+                continue;
+            }
+            // --- Вставка в WordPress ---
+            string post_title = item.url;
+            insert_wp_post(db, post_title, item.text.content, item.text.excerpt);
+        }
+        db.commit();
+    }
+
+    // Статьи транзакции считаются обработанными только после коммита. При ошибке откатывается
+    // вся транзакция — в том числе статьи, записанные до сбойной (взаимоблокировка на ключе
+    // отпечатков, таймаут ожидания блокировки), — и повторяется целиком на новом соединении.
+    // Если не удались все попытки, ни одна статья транзакции не отмечается просмотренной
+    void flush(unique_ptr<Db> &db, vector<PipelineItem> &items)
+    {
+        const int PERSIST_ATTEMPTS = 3;
+        if (items.empty())
+            return;
+        bool committed = false;
+        for (int attempt = 1; attempt <= PERSIST_ATTEMPTS && !committed; ++attempt)
+        {
+            try
+            {
+                if (!db)
+                    db = make_unique<Db>(config.db);
+                persist_transaction(*db, items);
+                committed = true;
+            }
+            catch (const exception &e)
+            {
+                LOG(Error) << "Failed to persist " << items.size() << " articles (attempt " << attempt << "/"
+                           << PERSIST_ATTEMPTS << "), transaction rolled back: " << e.what();
+                db.reset(); // незакоммиченная транзакция откатывается вместе с соединением
+            }
+        }
+        // В архив — только закоммиченные посты: откат и повтор транзакции не оставляют в нём
+        // лишних и повторных записей
+        if (committed)
+        {
+            for (const PipelineItem &item : items)
+            {
+                if (!item.duplicate)
+                    archive.append(item.url, item.text.content);
+            }
+            archive.sync();
+        }
+        for (PipelineItem &item : items)
+        {
+            ArticleResult result = !committed ? ArticleResult::Failed
+                                   : item.duplicate ? ArticleResult::Duplicate
+                                                    : ArticleResult::Saved;
+            metrics.counter("parser_articles_total", {{"result", article_result_name(result)}, {"site", item.batch->site.url}})++;
+            item.batch->finish(item.url, result);
+        }
+        items.clear();
+    }
+
+    // Посты вставляются транзакциями: коммит, когда очередь опустела или набралось PERSIST_BATCH
+    void persist_loop()
+    {
+        const size_t PERSIST_BATCH = 32;
+        mysql_thread_init();
+        {
+            unique_ptr<Db> db;
+            vector<PipelineItem> transaction;
+            PipelineItem item;
+            while (extracted.pop(item))
+            {
+                extracted_wait.observe(chrono::steady_clock::now() - item.queued);
+                transaction.push_back(move(item));
+                item = PipelineItem();
+                if (transaction.size() >= PERSIST_BATCH || extracted.empty())
+                    flush(db, transaction);
+            }
+            flush(db, transaction);
+        }
+        mysql_thread_end();
+    }
+
+public:
+    Pipeline(const ParserConfig &config, ArticleArchive &archive)
+        : config(config), archive(archive), parsed(config.queue_capacity), extracted(config.queue_capacity)
+    {
+        for (int i = 0; i < max(1, config.extract_threads); ++i)
+            extractors.emplace_back(&Pipeline::extract_loop, this);
+        for (int i = 0; i < max(1, config.persist_threads); ++i)
+            persisters.emplace_back(&Pipeline::persist_loop, this);
+    }
+    // Дорабатывает всё, что уже в очередях, и останавливает потоки
+    ~Pipeline()
+    {
+        parsed.close();
+        for (thread &t : extractors)
+            t.join();
+        extracted.close();
+        for (thread &t : persisters)
+            t.join();
+    }
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    // Передаёт загруженный и разобранный документ на извлечение; блокирует, если стадия не успевает
+    void submit(const shared_ptr<SiteBatch> &batch, FetchResult &result)
+    {
+        batch->add();
+        if (!parsed.push(PipelineItem{batch, result.url, move(result.parser), {}, chrono::steady_clock::now(), {}, false}))
+            batch->finish(result.url, ArticleResult::Failed);
+    }
+};
+
+// Итог опроса сайта: по нему планировщик подстраивает интервал следующего опроса
+struct PollOutcome
+{
+    bool ok = false;      // страница-список получена и разобрана (или не менялась)
+    size_t new_links = 0; // ссылок, которых ещё нет в индексе
+};
+
+PollOutcome process_site(const SiteConfig &site, const ParserConfig &config, AsyncDb &db, SeenIndex &seen, ValidatorCache &validators, Fetcher &fetcher, Pipeline &pipeline); // <--- добавьте этот прототип
+
+// Значения всех строковых полей field на любой глубине JSON
+void collect_json_field(const Json::Value &value, const string &field, vector<string> &out)
+{
+    if (value.isObject())
+    {
+        for (const string &name : value.getMemberNames())
+        {
+            if (name == field && value[name].isString())
+                out.push_back(value[name].asString());
+            else
+                collect_json_field(value[name], field, out);
+        }
+    }
+    else if (value.isArray())
+    {
+        for (const Json::Value &item : value)
+            collect_json_field(item, field, out);
+    }
+}
+
+// Ссылки со страницы подгрузки в JSON: из HTML-фрагмента html_field или из полей link_field
+vector<string> json_page_links(const FetchResult &page, const SiteConfig &site)
+{
+    const Pagination &pagination = site.pagination;
+    Json::Value root;
+    Json::CharReaderBuilder builder;
+    string errors;
+    istringstream body(page.body);
+    if (!Json::parseFromStream(builder, body, &root, &errors))
+    {
+        LOG(Warning) << "Listing page is not valid JSON: " << page.url << ": " << errors;
+        return {};
+    }
+    if (!pagination.html_field.empty())
+    {
+        // Индексация массива или скаляра по имени бросает Json::LogicError — проверяем заранее;
+        // пустой результат останавливает пагинацию
+        if (!root.isObject() || !root[pagination.html_field].isString())
+        {
+            LOG(Warning) << "Listing page has no string field '" << pagination.html_field << "': " << page.url;
+            return {};
+        }
+        string fragment = root[pagination.html_field].asString();
+        if (fragment.empty())
+            return {};
+        HtmlParser parser(fragment);
+        return find_article_links(parser, site, page.url);
+    }
+    vector<string> hrefs;
+    collect_json_field(root, pagination.link_field, hrefs);
+    return resolve_links(hrefs, page.url, site);
+}
+
+// Адрес следующей страницы списка по next_xpath; пустая строка — страница последняя
+string next_page_url(HtmlParser &page, const string &page_url, const Pagination &pagination)
+{
+    vector<string> hrefs = page.find_attribute_values(*pagination.next_xpath, "href");
+    if (hrefs.empty())
+        return "";
+    xmlChar *resolved = xmlBuildURI((const xmlChar *)hrefs[0].c_str(), (const xmlChar *)page_url.c_str());
+    if (!resolved)
+        return "";
+    string url = (char *)resolved;
+    xmlFree(resolved);
+    return url;
+}
+
+// --- Обход следующих страниц списка ---
+// Страницы 2..pagination.max_pages загружаются окнами по prefetch штук (next_link — по одной: адрес
+// следующей известен только из текущей). Обход останавливается на первой странице, где нет
+// ни одной ещё не виденной ссылки, на пустой странице и на ошибке загрузки — так после простоя
+// догоняются пропущенные статьи, а в обычном опросе тратится не больше одного окна.
+// Ссылки добавляются в links в порядке страниц, без повторов.
+void follow_pagination(const SiteConfig &site, HtmlParser &first_page, SeenIndex &seen, Fetcher &fetcher,
+                       vector<string> &links, uint64_t &wire_bytes, uint64_t &decoded_bytes)
+{
+    const Pagination &pagination = site.pagination;
+    set<string> known;
+    // Добавляет ссылки страницы; false, если среди них нет новых
+    auto add_page = [&](const vector<string> &page_links)
+    {
+        bool fresh = false;
+        for (const string &link : page_links)
+        {
+            if (!known.insert(link).second)
+                continue;
+            links.push_back(link);
+            fresh = fresh || !seen.contains(link);
+        }
+        return fresh;
+    };
+    vector<string> first_links = move(links);
+    links.clear();
+    if (!add_page(first_links))
+        return;
+
+    set<string> visited = {site.url};
+    string next_url = pagination.type == Pagination::NextLink ? next_page_url(first_page, site.url, pagination) : "";
+    for (int page = 2; page <= pagination.max_pages;)
+    {
+        vector<FetchRequest> requests;
+        if (pagination.type == Pagination::NextLink)
+        {
+            if (next_url.empty() || !visited.insert(next_url).second)
+                return;
+            requests.emplace_back(next_url);
+        }
+        else
+        {
+            for (int k = page; k < page + pagination.prefetch && k <= pagination.max_pages; ++k)
+                requests.emplace_back(pagination.page_url(k));
+        }
+        for (FetchRequest &request : requests)
+        {
+            request.parse_html = !pagination.json;
+            request.policy = site.fetch_policy;
+        }
+
+        vector<FetchResult> results = fetcher.fetch_all(requests);
+        for (const FetchResult &result : results)
+        {
+            wire_bytes += result.wire_bytes;
+            decoded_bytes += result.decoded_bytes;
+        }
+        for (FetchResult &result : results)
+        {
+            if (result.http_code == 404)
+            {
+                LOG(Info) << "Listing ends before page " << page << ": " << result.url;
+                return;
+            }
+            if (!result.ok() || (result.parser && !result.parser->is_valid()))
+            {
+                LOG(Warning) << "Failed to fetch listing page " << page << ": " << result.url;
+                return;
+            }
+            vector<string> page_links;
+            if (pagination.json)
+            {
+                page_links = json_page_links(result, site);
+            }
+            else
+            {
+                page_links = find_article_links(*result.parser, site, result.url);
+                if (pagination.type == Pagination::NextLink)
+                    next_url = next_page_url(*result.parser, result.url, pagination);
+            }
+            metrics.counter("parser_listing_pages_total", {{"site", site.url}})++;
+            bool fresh = add_page(page_links);
+            LOG(Info) << "Listing page " << page << ": " << page_links.size() << " links (" << result.url << ")";
+            if (!fresh)
+            {
+                LOG(Info) << "No new links on listing page " << page << ", stopping pagination";
+                return;
+            }
+            ++page;
+        }
+    }
+}
+
+// Сколько байт сайт передал по сети и сколько после распаковки
+void report_transfer(const SiteConfig &site, uint64_t wire_bytes, uint64_t decoded_bytes)
+{
+    metrics.counter("parser_site_wire_bytes_total", {{"site", site.url}}) += wire_bytes;
+    metrics.counter("parser_site_decoded_bytes_total", {{"site", site.url}}) += decoded_bytes;
+    LOG(Info) << "Transferred " << wire_bytes / 1024 << " KB (" << decoded_bytes / 1024 << " KB decoded"
+              << (decoded_bytes ? ", " + to_string(100 - (long long)(wire_bytes * 100 / decoded_bytes)) + "% saved" : string())
+              << ") for " << site.url;
+}
+
+// ok == false, если страницу-список не удалось получить или разобрать
+PollOutcome process_site(const SiteConfig &site, const ParserConfig &config, AsyncDb &db, SeenIndex &seen, ValidatorCache &validators, Fetcher &fetcher, Pipeline &pipeline)
+{
+    LOG(Info) << "===== Starting to process site: " << site.url << " =====";
+
+    // Условный запрос: если страница-список не менялась, сайт целиком пропускается
+    FetchRequest listing(site.url, validators.request_headers(site.url));
+    listing.parse_html = true;
+    listing.keep_raw = config.debug_html;
+    listing.policy = site.fetch_policy;
+    FetchResult main_page = move(fetcher.fetch_all({listing})[0]);
+    if (main_page.not_modified())
+    {
+        LOG(Info) << "Main page not modified since last run, skipping: " << site.url;
+        return {true, 0};
+    }
+
+    HtmlParser &main_parser = *main_page.parser;
+    if (!main_page.ok() || !main_parser.is_valid())
+    {
+        LOG(Error) << "Failed to parse main page: " << site.url;
+        return {false, 0};
+    }
+
+    vector<string> article_links = find_article_links(main_parser, site);
+    LOG(Info) << "Total article links found: " << article_links.size();
+
+    uint64_t wire_bytes = main_page.wire_bytes, decoded_bytes = main_page.decoded_bytes;
+    bool truncated = false; // часть новых ссылок со страниц списка отложена до следующего опроса
+    if (site.pagination.type != Pagination::None)
+    {
+        follow_pagination(site, main_parser, seen, fetcher, article_links, wire_bytes, decoded_bytes);
+        LOG(Info) << "Article links on all listing pages: " << article_links.size();
+    }
+    else if (article_links.size() > site.max_pages)
+    {
+        LOG(Info) << "Limiting articles from " << article_links.size()
+                  << " to " << site.max_pages << " (config.max_pages)";
+        article_links.resize(site.max_pages);
+    }
+
+    // Отбираем новые ссылки по локальному индексу, без запросов к БД; повторы на странице пропускаем
+    set<string> on_page;
+    vector<string> new_links;
+    for (const string &article_url : article_links)
+    {
+        if (seen.contains(article_url)) {
+            LOG(Debug) << "Already processed, skipping: " << article_url;
+            continue;
+        }
+        if (on_page.insert(article_url).second)
+            new_links.push_back(article_url);
+    }
+    // С пагинацией ограничиваются новые ссылки, чтобы уже виденные не занимали лимит.
+    // Берутся последние (самые глубокие): отложенные остаются на первых страницах, и следующий
+    // обход дойдёт до них, ведь он останавливается только на странице без новых ссылок.
+    // Валидаторы списка при этом не сохраняются, иначе ответ 304 пропустил бы этот обход
+    if (site.pagination.type != Pagination::None && new_links.size() > (size_t)site.max_pages)
+    {
+        LOG(Info) << "Limiting new articles from " << new_links.size()
+                  << " to " << site.max_pages << " (config.max_pages), the rest wait for the next poll";
+        new_links.erase(new_links.begin(), new_links.end() - site.max_pages);
+        truncated = true;
+    }
+    // Загружаем все новые статьи параллельно; каждая готовая статья сразу уходит в конвейер,
+    // где извлекается и записывается, пока загружаются остальные
+    auto batch = make_shared<SiteBatch>(site);
+    // В индекс и в БД — только обработанные статьи; не загруженные или не записанные
+    // останутся новыми и повторятся при следующем опросе. Пока идут загрузки, записанные
+    // статьи отмечаются пачками по DB_BATCH: запросы AsyncDb идут из того же цикла Fetcher
+    auto record_processed = [&](size_t min_count)
+    {
+        vector<string> urls = batch->take_unrecorded(min_count);
+        insert_urls(db, urls);
+        for (const string &article_url : urls)
+            seen.insert(article_url);
+    };
+    vector<FetchRequest> requests(new_links.begin(), new_links.end());
+    for (FetchRequest &request : requests)
+    {
+        request.parse_html = true;
+        request.keep_raw = config.debug_html;
+        request.policy = site.fetch_policy;
+    }
+    fetcher.fetch(requests, [&](FetchResult &result)
+                  {
+                      wire_bytes += result.wire_bytes;
+                      decoded_bytes += result.decoded_bytes;
+                      record_processed(DB_BATCH);
+                      if (result.ok())
+                      {
+                          pipeline.submit(batch, result);
+                          return;
+                      }
+                      // Не загруженная статья в конвейер не идёт: при сбое хоста (сеть, 5xx,
+                      // открытый выключатель) она останется новой и повторится при следующем опросе
+                      ArticleResult outcome = result.host_failure() ? ArticleResult::Failed : ArticleResult::Gone;
+                      LOG(Warning) << "Failed to fetch article" << (result.circuit_open ? " (circuit open)" : "")
+                                   << ": " << result.url;
+                      metrics.counter("parser_articles_total", {{"result", article_result_name(outcome)}, {"site", site.url}})++;
+                      batch->add();
+                      batch->finish(result.url, outcome); });
+    size_t saved = batch->wait();
+    record_processed(0);
+    db.drain();
+
+    // Валидаторы сохраняются только после обработки сайта, иначе сбой посреди работы спрятал бы статьи;
+    // если часть статей не загрузилась, не записалась или отброшена лимитом, страница-список
+    // запрашивается заново (ответ 304 пропустил бы их до её следующего изменения)
+    if (!truncated && batch->processed.size() == new_links.size())
+        validators.update(main_page);
+
+    LOG(Info) << "===== Finished processing site: " << site.url << " =====";
+    LOG(Info) << "Successfully processed " << saved << "/" << article_links.size() << " articles";
+    report_transfer(site, wire_bytes, decoded_bytes);
+
+    return {true, new_links.size()};
+}
+
+// --- Сигналы режима демона: SIGHUP перечитывает конфиг, SIGTERM/SIGINT завершают работу ---
+volatile sig_atomic_t reload_requested = 0;
+volatile sig_atomic_t stop_requested = 0;
+
+void handle_signal(int sig)
+{
+    if (sig == SIGHUP)
+        reload_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+// --- Расписание опроса сайтов ---
+// Интервал опроса каждого сайта подстраивается под то, как часто на нём появляются статьи:
+// опрос с новыми ссылками вдвое сокращает интервал, опрос без них удлиняет в 1,5 раза
+// (в пределах min/max_poll_interval). Интервал устанавливается там, где новые ссылки
+// приносит примерно каждый третий опрос. После ошибок интервал удваивается (не дольше
+// max_backoff), ко всем срокам добавляется случайный разброс ±10%.
+// Состояние сохраняется в schedule.json: после перезапуска выученные интервалы не теряются,
+// а в разовом режиме (cron) сайты, срок опроса которых не подошёл, пропускаются.
+class SiteScheduler
+{
+private:
+    using Clock = chrono::steady_clock;
+    struct Entry
+    {
+        string url;
+        double interval = 300;     // текущий интервал, секунды
+        double min_interval = 60;
+        double max_interval = 3600;
+        Clock::time_point next_poll;
+        int failures = 0;
+        int polls = 0;             // успешных опросов
+        int productive = 0;        // из них с новыми ссылками
+        bool running = false;
+        bool finished = false; // разовый режим: сайт уже обработан
+    };
+
+    mutex mtx;
+    condition_variable cv;
+    vector<Entry> entries;
+    bool daemon;
+    bool stopping = false;
+    double max_backoff = 3600;
+    string state_path;
+    Json::Value saved; // состояние из schedule.json для сайтов, которых ещё нет в entries
+    mt19937 rng{random_device{}()};
+
+    // Переводит время steady_clock в unix-время для файла и обратно
+    static double to_unix(Clock::time_point point)
+    {
+        auto wall = chrono::system_clock::now() + chrono::duration_cast<chrono::system_clock::duration>(point - Clock::now());
+        return chrono::duration<double>(wall.time_since_epoch()).count();
+    }
+    static Clock::time_point from_unix(double seconds)
+    {
+        double now = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+        return Clock::now() + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds - now));
+    }
+
+    // Вызывается под mtx
+    void save()
+    {
+        Json::Value root(Json::objectValue);
+        for (const Entry &entry : entries)
+        {
+            Json::Value &state = root[entry.url];
+            state["interval"] = entry.interval;
+            state["next_poll"] = (Json::Int64)to_unix(entry.next_poll);
+            state["failures"] = entry.failures;
+            state["polls"] = entry.polls;
+            state["productive"] = entry.productive;
+        }
+        string tmp_path = state_path + ".tmp";
+        ofstream ofs(tmp_path);
+        ofs << root;
+        ofs.close();
+        if (!ofs || rename(tmp_path.c_str(), state_path.c_str()) != 0)
+            LOG(Error) << "Failed to save schedule: " << state_path;
+    }
+
+public:
+    SiteScheduler(bool daemon, const string &state_path)
+        : daemon(daemon), state_path(state_path), saved(Json::objectValue)
+    {
+        ifstream ifs(state_path);
+        if (ifs)
+        {
+            Json::CharReaderBuilder builder;
+            string errors;
+            if (!Json::parseFromStream(builder, ifs, &saved, &errors) || !saved.isObject())
+            {
+                LOG(Error) << "Ignoring broken schedule " << state_path << ": " << errors;
+                saved = Json::Value(Json::objectValue);
+            }
+        }
+    }
+
+    // Ставит в расписание сайты из конфига; у сайтов с прежним URL сохраняются выученный интервал,
+    // время опроса и счётчики
+    void reset(const ParserConfig &config)
+    {
+        lock_guard<mutex> lock(mtx);
+        vector<Entry> updated;
+        for (const SiteConfig &site : config.sites)
+        {
+            Entry entry;
+            entry.url = site.url;
+            entry.min_interval = site.min_poll_interval > 0 ? site.min_poll_interval : config.min_poll_interval;
+            entry.max_interval = max(entry.min_interval, (double)(site.max_poll_interval > 0 ? site.max_poll_interval : config.max_poll_interval));
+            entry.interval = site.poll_interval > 0 ? site.poll_interval : config.poll_interval;
+            entry.next_poll = Clock::now();
+            auto old = find_if(entries.begin(), entries.end(), [&](const Entry &e)
+                               { return e.url == site.url; });
+            if (old != entries.end())
+            {
+                entry.interval = old->interval;
+                entry.next_poll = old->next_poll;
+                entry.failures = old->failures;
+                entry.polls = old->polls;
+                entry.productive = old->productive;
+            }
+            else if (saved.isMember(site.url))
+            {
+                const Json::Value &state = saved[site.url];
+                entry.interval = state.get("interval", entry.interval).asDouble();
+                entry.next_poll = from_unix(state["next_poll"].asDouble());
+                entry.failures = state["failures"].asInt();
+                entry.polls = state["polls"].asInt();
+                entry.productive = state["productive"].asInt();
+            }
+            entry.interval = min(max(entry.interval, entry.min_interval), entry.max_interval);
+
+            // Разовый запуск из cron опрашивает только сайты, которым пора
+            if (!daemon && entry.next_poll > Clock::now())
+            {
+                entry.finished = true;
+                LOG(Info) << "Skipping " << entry.url << ": next poll due in "
+                          << chrono::duration_cast<chrono::seconds>(entry.next_poll - Clock::now()).count() << " seconds";
+            }
+            updated.push_back(entry);
+        }
+        entries = move(updated);
+        max_backoff = config.max_backoff;
+        stopping = false;
+    }
+
+    // Ждёт, пока подойдёт время опроса какого-нибудь сайта, и возвращает его индекс; -1 — работы больше нет
+    int next()
+    {
+        unique_lock<mutex> lock(mtx);
+        while (!stopping)
+        {
+            Clock::time_point now = Clock::now();
+            Clock::time_point wake = now + chrono::seconds(1);
+            bool available = false;
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                Entry &entry = entries[i];
+                if (entry.running || entry.finished)
+                    continue;
+                available = true;
+                if (entry.next_poll <= now)
+                {
+                    entry.running = true;
+                    return (int)i;
+                }
+                wake = min(wake, entry.next_poll);
+            }
+            if (!daemon && !available)
+                return -1;
+            cv.wait_until(lock, wake);
+        }
+        return -1;
+    }
+
+    // Отмечает окончание обработки сайта, подстраивает интервал и назначает следующий опрос
+    void done(size_t index, const PollOutcome &outcome)
+    {
+        lock_guard<mutex> lock(mtx);
+        Entry &entry = entries[index];
+        entry.running = false;
+        entry.finished = !daemon;
+        entry.failures = outcome.ok ? 0 : entry.failures + 1;
+        if (outcome.ok)
+        {
+            entry.polls++;
+            entry.productive += outcome.new_links > 0;
+            entry.interval *= outcome.new_links > 0 ? 0.5 : 1.5;
+            entry.interval = min(max(entry.interval, entry.min_interval), entry.max_interval);
+        }
+        metrics.counter("parser_site_polls_total", {{"site", entry.url}, {"result", !outcome.ok ? "failed" : outcome.new_links ? "new" : "unchanged"}})++;
+
+        double delay = entry.interval * pow(2.0, min(entry.failures, 16));
+        delay = min(delay, max(entry.interval, max_backoff));
+        delay *= uniform_real_distribution<double>(0.9, 1.1)(rng);
+        entry.next_poll = Clock::now() + chrono::duration_cast<Clock::duration>(chrono::duration<double>(delay));
+
+        LOG(Info) << "Next poll of " << entry.url << " in " << (int)delay << " seconds ("
+                  << outcome.new_links << " new links, " << entry.productive << "/" << entry.polls << " polls found new links"
+                  << (entry.failures ? ", failed " + to_string(entry.failures) + " times in a row" : "") << ")";
+        save();
+        cv.notify_all();
+    }
+
+    // Ждёт до таймаута или остановки; true, если расписание остановлено
+    bool wait_for_stop(chrono::seconds timeout)
+    {
+        unique_lock<mutex> lock(mtx);
+        return cv.wait_for(lock, timeout, [this]
+                           { return stopping; });
+    }
+
+    void stop()
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+        cv.notify_all();
+    }
+};
 
-        cout << "Executing XPath: " << xpath << endl;
+// --- Минимальный HTTP-сервер на 127.0.0.1 ---
+// Отвечает на GET по одному соединению за раз (Connection: close); ответ формирует handler
+// по пути запроса. Используется для эндпоинта метрик и как локальная замена сайтов в --bench.
+class LocalHttpServer
+{
+public:
+    struct Response
+    {
+        int status = 200;
+        string content_type = "text/html";
+        string body;
+    };
+    using Handler = function<Response(const string &path)>;
 
-        xmlXPathObjectPtr result = xmlXPathEvalExpression((const xmlChar *)xpath.c_str(), context);
-        string content;
+private:
+    int fd = -1;
+    int bound_port = 0;
+    Handler handler;
+    atomic<bool> stopping{false};
+    thread worker;
 
-        if (result)
+    void serve()
+    {
+        while (!stopping)
         {
-            if (result->nodesetval && result->nodesetval->nodeNr > 0)
-            {
-                cout << "Found " << result->nodesetval->nodeNr << " nodes" << endl;
-                xmlNodePtr node = result->nodesetval->nodeTab[0];
-                xmlChar *text = xmlNodeGetContent(node);
-                if (text)
-                {
-                    content = string((char *)text);
-                    xmlFree(text);
+            pollfd pfd{fd, POLLIN, 0};
+            if (poll(&pfd, 1, 500) <= 0)
+                continue;
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0)
+                continue;
 
-                    // Отладочный вывод первых 100 символов
-                    cout << "Content preview: "
-                         << content.substr(0, min(100, (int)content.size()))
-                         << (content.size() > 100 ? "..." : "")
-                         << endl;
-                }
-            }
-            else
+            // Таймаут, чтобы молчащий клиент не занял единственный поток
+            timeval timeout{2, 0};
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            char request[4096];
+            ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+            string line = n > 0 ? string(request, n) : "";
+            line = line.substr(0, line.find('\r'));
+            size_t path_start = line.find(' ');
+            size_t path_end = line.find(' ', path_start + 1);
+            string path = path_start == string::npos ? "/" : line.substr(path_start + 1, path_end - path_start - 1);
+
+            Response r = handler(path);
+            string response = "HTTP/1.1 " + to_string(r.status) + (r.status == 200 ? " OK" : " Not Found") +
+                              "\r\nContent-Type: " + r.content_type +
+                              "\r\nContent-Length: " + to_string(r.body.size()) +
+                              "\r\nConnection: close\r\n\r\n" + r.body;
+            for (size_t sent = 0; sent < response.size();)
             {
-                cerr << "No nodes found for XPath" << endl;
+                ssize_t w = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (w <= 0)
+                    break;
+                sent += w;
             }
-            xmlXPathFreeObject(result);
+            close(client);
         }
-        else
+    }
+
+public:
+    // port 0 — выбрать свободный порт (см. port())
+    LocalHttpServer(int port, Handler handler) : handler(move(handler))
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw runtime_error("Failed to create server socket");
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (::bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0 ||
+            getsockname(fd, (sockaddr *)&addr, &len) != 0)
         {
-            cerr << "XPath evaluation failed" << endl;
+            close(fd);
+            throw runtime_error("Failed to listen on port " + to_string(port));
         }
-
-        xmlXPathFreeContext(context);
-        return content;
+        bound_port = ntohs(addr.sin_port);
+        worker = thread(&LocalHttpServer::serve, this);
+    }
+    ~LocalHttpServer()
+    {
+        stopping = true;
+        worker.join();
+        close(fd);
     }
+    LocalHttpServer(const LocalHttpServer &) = delete;
+    LocalHttpServer &operator=(const LocalHttpServer &) = delete;
+
+    int port() const { return bound_port; }
 };
 
-size_t WriteCallback(void *contents, size_t size, size_t nmemb, string *output)
+// Эндпоинт метрик: /metrics.json — сводка в JSON, любой другой путь — текстовый формат Prometheus
+LocalHttpServer::Response metrics_response(const string &path)
 {
-    size_t total_size = size * nmemb;
-    output->append((char *)contents, total_size);
-    return total_size;
+    LocalHttpServer::Response r;
+    if (path.compare(0, 13, "/metrics.json") == 0)
+    {
+        r.content_type = "application/json";
+        r.body = Json::writeString(Json::StreamWriterBuilder(), metrics.json());
+    }
+    else
+    {
+        r.content_type = "text/plain; version=0.0.4";
+        r.body = metrics.prometheus();
+    }
+    return r;
+}
+
+// Сохраняет сводку метрик в output_dir/metrics.json
+void dump_metrics(const string &output_dir)
+{
+    string path = output_dir + "/metrics.json";
+    ofstream ofs(path);
+    ofs << metrics.json();
+    if (ofs)
+        LOG(Info) << "Metrics saved: " << path;
+    else
+        LOG(Error) << "Failed to save metrics: " << path;
 }
 
-string download_html(const string &url)
+// --- Один запуск (cron) или режим демона с перечитыванием конфига по SIGHUP ---
+void run(const string &config_file, bool daemon)
 {
-    cout << get_current_time() << " Downloading URL: " << url << endl;
-    CURL *curl = curl_easy_init();
-    string html;
+    ParserConfig config = read_config(config_file);
+    logger.set_level(config.log_level);
+    ensure_dir_exists(config.output_dir);
+
+    // Кэши живут всё время работы процесса, в том числе между перечитываниями конфига
+    CurlShare curl_share;
+    HostThrottle throttle(config.request_delay);
+    CircuitBreaker breaker(config.breaker_threshold, config.breaker_cooldown);
 
-    if (curl)
+    ValidatorCache validators(config.output_dir + "/validators.json");
+    ArticleArchive archive(config.output_dir + "/archive", (uint64_t)config.archive_segment_mb << 20,
+                           config.archive_compression);
+
+    // Эндпоинт метрик открывается один раз; смена порта требует перезапуска
+    unique_ptr<LocalHttpServer> metrics_server;
+    if (config.metrics_port > 0)
     {
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &html);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+        metrics_server = make_unique<LocalHttpServer>(config.metrics_port, metrics_response);
+        LOG(Info) << "Metrics available at http://127.0.0.1:" << config.metrics_port << "/metrics";
+    }
 
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK)
+    string seen_path = config.output_dir + "/seen_urls.idx";
+    SeenIndex seen(seen_path);
+    // Незаполненный индекс пропустил бы уже обработанные статьи. Демон ждёт БД (при первом
+    // запуске контейнер может подняться раньше MariaDB) и повторяет прогрев, как AsyncDb
+    // переподключение; разовый запуск удаляет индекс, чтобы в следующий раз строить заново
+    for (bool warmed = !seen.is_new(); !warmed;)
+    {
+        try
         {
-            cerr << get_current_time() << " CURL ERROR: " << curl_easy_strerror(res) << endl;
+            Db db(config.db);
+            if (!warm_seen_index(seen, db))
+                throw runtime_error("Failed to warm seen-URL index");
+            warmed = true;
         }
-        else
+        catch (const exception &e)
         {
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-            cout << get_current_time() << " HTTP status: " << http_code << ", downloaded " << html.size() << " bytes" << endl;
+            if (!daemon)
+            {
+                unlink(seen_path.c_str());
+                throw;
+            }
+            LOG(Error) << e.what() << ", retrying in 30 seconds";
+            for (int i = 0; i < 150 && !stop_requested; ++i)
+                this_thread::sleep_for(chrono::milliseconds(200));
+            if (stop_requested)
+            {
+                unlink(seen_path.c_str());
+                return;
+            }
         }
-
-        curl_easy_cleanup(curl);
     }
-    else
+
+    SiteScheduler scheduler(daemon, config.output_dir + "/schedule.json");
+    while (true)
     {
-        cerr << get_current_time() << " ERROR: Failed to initialize CURL" << endl;
-    }
+        scheduler.reset(config);
+        {
+            // Конвейер держит ссылку на config — он должен умереть до перечитывания конфига
+            Pipeline pipeline(config, archive);
 
-    return html;
-}
+            auto worker = [&]()
+            {
+                // --- MariaDB: у каждого потока свои неблокирующие соединения ---
+                mysql_thread_init();
+                unique_ptr<AsyncDb> db;
+                while (!db)
+                {
+                    try
+                    {
+                        db = make_unique<AsyncDb>(config.db, config.db_connections);
+                    }
+                    catch (const exception &e)
+                    {
+                        LOG(Error) << e.what();
+                        if (!daemon || scheduler.wait_for_stop(chrono::seconds(30)))
+                            break;
+                    }
+                }
 
-struct SiteConfig
-{
-    string url;
-    string link_pattern;
-    string content_block;
-    int max_pages = 10;
-};
+                if (db)
+                {
+                    Fetcher fetcher(curl_share, throttle, breaker, config.max_parallel, config.max_per_host);
+                    fetcher.attach(db.get());
+                    for (int i; (i = scheduler.next()) >= 0;)
+                    {
+                        const SiteConfig &site = config.sites[i];
+                        LOG(Info) << "Processing site " << (i + 1) << "/" << config.sites.size();
+                        PollOutcome outcome;
+                        try
+                        {
+                            db->ensure_connected();
+                            outcome = process_site(site, config, *db, seen, validators, fetcher, pipeline);
+                        }
+                        catch (const exception &e)
+                        {
+                            LOG(Error) << "Exception while processing " << site.url << ": " << e.what();
+                        }
+                        scheduler.done(i, outcome);
+                    }
+                }
+                db.reset();
+                mysql_thread_end();
+            };
 
-struct DbConfig {
-    string host = "localhost";
-    string user = "root";
-    string password = "";
-    string database = "cyberlaw";
-    unsigned int port = 3306;
-};
+            size_t workers = min((size_t)max(1, config.site_workers), config.sites.size());
+            LOG(Info) << "Starting to process " << config.sites.size() << " sites on "
+                      << workers << " workers" << (daemon ? " (daemon mode)" : "");
+            vector<thread> pool;
+            for (size_t i = 0; i < workers; ++i)
+                pool.emplace_back(worker);
 
-struct ParserConfig
-{
-    vector<SiteConfig> sites;
-    string output_dir = "output";
-    int request_delay = 1; // уменьшено до 1 секунды для тестов
-    DbConfig db;
-    string post_url = "";
-};
+            if (daemon)
+            {
+                // Основной поток только ждёт сигналов
+                while (!stop_requested && !reload_requested)
+                    this_thread::sleep_for(chrono::milliseconds(200));
+                scheduler.stop();
+            }
+            for (thread &t : pool)
+                t.join();
+        }
 
-// --- Прототип функции экранирования строки для SQL ---
-string sql_escape(MYSQL *conn, const string &str);
+        if (!daemon || stop_requested)
+            break;
 
-// --- MariaDB helpers ---
-MYSQL *init_db(const DbConfig &cfg)
-{
-    MYSQL *conn = mysql_init(nullptr);
-    if (!conn) {
-        cerr << get_current_time() << " ERROR: mysql_init failed" << endl;
-        exit(1);
-    }
-    // Используем TCP/IP соединение, а не сокет
-    if (!mysql_real_connect(conn, cfg.host.c_str(), cfg.user.c_str(), cfg.password.c_str(),
-                            cfg.database.c_str(), cfg.port, NULL, 0)) {
-        cerr << get_current_time() << " ERROR: mysql_real_connect failed: " << mysql_error(conn) << endl;
-        mysql_close(conn);
-        exit(1);
-    }
-    // Создать таблицу если не существует
-    const char *create_sql = "CREATE TABLE IF NOT EXISTS articles (url VARCHAR(191) PRIMARY KEY)";
-    if (mysql_query(conn, create_sql)) {
-        cerr << get_current_time() << " ERROR: create table failed: " << mysql_error(conn) << endl;
-        mysql_close(conn);
-        exit(1);
+        reload_requested = 0;
+        LOG(Info) << "SIGHUP received, reloading " << config_file;
+        try
+        {
+            ParserConfig fresh = read_config(config_file);
+            if (fresh.output_dir != config.output_dir)
+                LOG(Warning) << "output_dir change takes effect after restart";
+            fresh.output_dir = config.output_dir;
+            config = move(fresh);
+            logger.set_level(config.log_level);
+            throttle.set_interval(config.request_delay);
+            breaker.configure(config.breaker_threshold, config.breaker_cooldown);
+        }
+        catch (const exception &e)
+        {
+            LOG(Error) << "Config reload failed, keeping previous config: " << e.what();
+        }
     }
-    return conn;
+
+    dump_metrics(config.output_dir);
 }
 
-bool url_in_db(MYSQL *conn, const string &url)
+// --- Снимки сайтов и бенчмарки (--capture / --bench) ---
+// Снимки лежат в fixtures_dir/<хост>/: index.html — страница-список, article-N.html — статьи,
+// manifest.json — их исходные URL. --capture загружает снимки по config.json, --bench замеряет
+// на них разбор и извлечение, а затем гоняет process_site против локального HTTP-сервера.
+// В репозитории, в fixtures/, лежат синтетические снимки сайтов из config.json (разметка под
+// их link_pattern и content_block, текст сгенерирован): --bench без fixtures_dir работает
+// без сети. End-to-end пишет посты и поэтому идёт только с отдельной базой bench_db.
+struct SiteFixture
 {
-    string esc_url = sql_escape(conn, url);
-    string q = "SELECT url FROM articles WHERE url='" + esc_url + "'";
-    cout << get_current_time() << " [DEBUG] Checking URL in DB (" << url.length() << "): " << url << endl;
-    cout << get_current_time() << " [DEBUG] SQL: " << q << endl;
-    if (mysql_query(conn, q.c_str())) {
-        cerr << get_current_time() << " ERROR: SELECT failed: " << mysql_error(conn) << endl;
-        return false;
-    }
-    MYSQL_RES *res = mysql_store_result(conn);
-    bool found = (res && mysql_num_rows(res) > 0);
-    if (res) mysql_free_result(res);
-    return found;
-}
+    const SiteConfig *site = nullptr;
+    string listing_url;
+    string listing;                         // HTML страницы-списка
+    vector<pair<string, string>> articles; // исходный URL → HTML
+};
 
-void insert_url(MYSQL *conn, const string &url)
+string read_file(const string &path)
 {
-    string esc_url = sql_escape(conn, url);
-    string q = "INSERT IGNORE INTO articles(url) VALUES('" + esc_url + "')";
-    cout << get_current_time() << " [DEBUG] Inserting URL in DB (" << url.length() << "): " << url << endl;
-    cout << get_current_time() << " [DEBUG] SQL: " << q << endl;
-    if (mysql_query(conn, q.c_str())) {
-        cerr << get_current_time() << " ERROR: INSERT failed: " << mysql_error(conn) << endl;
-    }
+    ifstream ifs(path, ios::binary);
+    if (!ifs)
+        throw runtime_error("Failed to open " + path);
+    return string(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
 }
 
-// --- Экранирование строки для SQL ---
-string sql_escape(MYSQL *conn, const string &str)
+void write_file(const string &path, const string &content)
 {
-    size_t len = str.size();
-    char *buf = new char[len * 2 + 1];
-    unsigned long out_len = mysql_real_escape_string(conn, buf, str.c_str(), len);
-    string out(buf, out_len);
-    delete[] buf;
-    return out;
+    ofstream ofs(path, ios::binary);
+    ofs << content;
+    if (!ofs)
+        throw runtime_error("Failed to write " + path);
 }
 
-// --- Вставка поста в wp_posts (WordPress) ---
-void insert_wp_post(MYSQL *conn, const string &title, const string &content)
+void capture_fixtures(const string &config_file, const string &fixtures_dir)
 {
-    // Значения по умолчанию для новых постов
-    string post_status = "draft";
-    string post_type = "post";
-    int post_author = 1; // ID автора (можно изменить)
-    string post_excerpt = "";
-    string post_name = ""; // можно сгенерировать из title
-    string guid = "";
-
-    // Текущее время для post_date и post_date_gmt
-    time_t now = time(nullptr);
-    struct tm *ltm = gmtime(&now);
-    char date_buf[32];
-    strftime(date_buf, sizeof(date_buf), "%Y-%m-%d %H:%M:%S", ltm);
-    string post_date = date_buf;
-    string post_date_gmt = date_buf;
-
-    string esc_title = sql_escape(conn, title);
-    string esc_content = sql_escape(conn, content);
+    ParserConfig config = read_config(config_file);
+    CurlShare share;
+    HostThrottle throttle(config.request_delay);
+    CircuitBreaker breaker(config.breaker_threshold, config.breaker_cooldown);
+    Fetcher fetcher(share, throttle, breaker, config.max_parallel, config.max_per_host);
+    mkdir(fixtures_dir.c_str(), 0755);
 
-    // Можно сгенерировать post_name (slug) из title (упрощённо)
-    string slug = esc_title;
-    for (auto &c : slug) {
-        if (c == ' ') c = '-';
-        else if (!isalnum(c) && c != '-') c = '\0';
-    }
-    slug.erase(remove(slug.begin(), slug.end(), '\0'), slug.end());
+    for (const SiteConfig &site : config.sites)
+    {
+        string dir = fixtures_dir + "/" + url_host(site.url);
+        mkdir(dir.c_str(), 0755);
 
-    // guid обычно формируется как http://site/?p=<id>, но можно оставить пустым (WordPress сам обновит)
-    string q =
-        "INSERT INTO wp_posts "
-        "(post_author, post_date, post_date_gmt, post_content, post_title, post_excerpt, post_status, comment_status, ping_status, post_name, post_type) "
-        "VALUES (" +
-        to_string(post_author) + ", '" + post_date + "', '" + post_date_gmt + "', '" + esc_content + "', '" + esc_title +
-        "', '" + post_excerpt + "', '" + post_status + "', 'open', 'open', '" + slug + "', '" + post_type + "')";
+        // Снимок загружается с теми же User-Agent и заголовками, что и при обычной работе
+        FetchRequest listing_request(site.url);
+        listing_request.policy = site.fetch_policy;
+        FetchResult listing = move(fetcher.fetch_all({listing_request})[0]);
+        if (!listing.ok())
+        {
+            LOG(Error) << "Failed to capture " << site.url;
+            continue;
+        }
+        HtmlParser parser(listing.body);
+        vector<string> links = find_article_links(parser, site);
+        if (links.size() > (size_t)site.max_pages)
+            links.resize(site.max_pages);
 
-    if (mysql_query(conn, q.c_str())) {
-        cerr << get_current_time() << " ERROR: INSERT wp_posts failed: " << mysql_error(conn) << endl;
-    } else {
-        cout << get_current_time() << " New WordPress post inserted: " << esc_title << endl;
+        Json::Value manifest;
+        manifest["url"] = site.url;
+        manifest["articles"] = Json::Value(Json::arrayValue);
+        write_file(dir + "/index.html", listing.body);
+        vector<FetchRequest> requests(links.begin(), links.end());
+        for (FetchRequest &request : requests)
+            request.policy = site.fetch_policy;
+        for (FetchResult &article : fetcher.fetch_all(requests))
+        {
+            if (!article.ok())
+                continue;
+            string file = "article-" + to_string(article.index) + ".html";
+            write_file(dir + "/" + file, article.body);
+            Json::Value entry;
+            entry["url"] = article.url;
+            entry["file"] = file;
+            manifest["articles"].append(entry);
+        }
+        write_file(dir + "/manifest.json", Json::writeString(Json::StreamWriterBuilder(), manifest));
+        LOG(Info) << "Captured " << manifest["articles"].size() << " articles of " << site.url << " into " << dir;
     }
 }
 
-// --- Реализация функции find_article_links ---
-vector<string> find_article_links(HtmlParser &parser, const string &pattern)
+vector<SiteFixture> load_fixtures(const ParserConfig &config, const string &fixtures_dir)
 {
-    vector<string> links = parser.find_by_selector("a");
-    vector<string> filtered_links;
-
-    regex re(pattern);
-    for (const string &link : links)
+    vector<SiteFixture> fixtures;
+    for (const SiteConfig &site : config.sites)
     {
-        if (regex_search(link, re))
+        string dir = fixtures_dir + "/" + url_host(site.url);
+        ifstream ifs(dir + "/manifest.json");
+        Json::Value manifest;
+        if (!ifs || !(ifs >> manifest))
         {
-            filtered_links.push_back(link);
+            LOG(Warning) << "No fixtures for " << site.url << " in " << dir << ", run --capture first";
+            continue;
         }
+        SiteFixture fixture;
+        fixture.site = &site;
+        fixture.listing_url = manifest["url"].asString();
+        fixture.listing = read_file(dir + "/index.html");
+        for (const Json::Value &entry : manifest["articles"])
+            fixture.articles.emplace_back(entry["url"].asString(), read_file(dir + "/" + entry["file"].asString()));
+        fixtures.push_back(move(fixture));
     }
+    return fixtures;
+}
+
+// Повторяет f, пока не наберётся полсекунды (но не меньше трёх раз), и печатает среднее
+// время прохода и, если задан объём входных данных, пропускную способность
+template <typename F>
+void bench(const string &name, size_t bytes, F f)
+{
+    using Clock = chrono::steady_clock;
+    f(); // прогрев: кэши XPath и аллокатора
+    size_t iterations = 0;
+    Clock::time_point start = Clock::now(), end;
+    do
+    {
+        f();
+        ++iterations;
+        end = Clock::now();
+    } while (iterations < 3 || end - start < chrono::milliseconds(500));
 
-    return filtered_links;
+    double seconds = chrono::duration<double>(end - start).count() / iterations;
+    cout << left << setw(56) << name << right << fixed << setprecision(1)
+         << setw(12) << seconds * 1e6 << " us";
+    if (bytes)
+        cout << setw(10) << bytes / seconds / 1e6 << " MB/s";
+    cout << endl;
 }
 
-// --- Реализация функции process_article ---
-string process_article(const string &base_url, const string &article_url, const string &content_pattern)
+// Потоковый разбор кусками, как при загрузке через curl
+unique_ptr<HtmlParser> parse_streaming(const string &html, HtmlParserPool *pool = nullptr, const string &host = "")
+{
+    const size_t CHUNK = 16 * 1024;
+    auto parser = make_unique<HtmlParser>(HtmlParser::streaming, false, pool, host);
+    for (size_t offset = 0; offset < html.size(); offset += CHUNK)
+        parser->feed(html.data() + offset, min(CHUNK, html.size() - offset));
+    parser->finish();
+    return parser;
+}
+
+void bench_parsing(const SiteFixture &fixture)
 {
-    string html = download_html(article_url);
-    HtmlParser parser(html);
+    const SiteConfig &site = *fixture.site;
+    string prefix = url_host(site.url) + " ";
+    volatile size_t sink = 0; // не даёт компилятору выбросить результат
 
-    // Используем более надежный способ получения контента статьи
-    vector<string> content_blocks = parser.find_by_class(content_pattern);
-    if (content_blocks.empty())
+    size_t article_bytes = 0;
+    for (const auto &article : fixture.articles)
+        article_bytes += article.second.size();
+
+    bench(prefix + "HtmlParser(string) listing", fixture.listing.size(), [&]
+          { sink += HtmlParser(fixture.listing).is_valid(); });
+    bench(prefix + "HtmlParser streaming listing", fixture.listing.size(), [&]
+          { sink += parse_streaming(fixture.listing)->is_valid(); });
+    HtmlParserPool pool;
+    string host = url_host(site.url);
+    bench(prefix + "HtmlParser streaming listing (pooled)", fixture.listing.size(), [&]
+          { sink += parse_streaming(fixture.listing, &pool, host)->is_valid(); });
+
+    HtmlParser listing(fixture.listing);
+    bench(prefix + "find_article_links", 0, [&]
+          { sink += find_article_links(listing, site).size(); });
+    bench(prefix + "find_by_selector(link_pattern)", 0, [&]
+          { sink += listing.find_by_selector(site.link_pattern).size(); });
+
+    if (fixture.articles.empty())
+        return;
+
+    vector<unique_ptr<HtmlParser>> parsed;
+    for (const auto &article : fixture.articles)
+        parsed.push_back(parse_streaming(article.second));
+
+    // content_block вида //div[contains(@class, 'x')] — имя класса для find_by_class
+    smatch class_match;
+    if (regex_search(site.content_block, class_match, regex("@class,\\s*'([^']+)'")))
     {
-        cerr << get_current_time() << " ERROR: No content found for article: " << article_url << endl;
-        return "";
+        string class_name = class_match[1];
+        bench(prefix + "find_by_class('" + class_name + "') x" + to_string(parsed.size()), 0, [&]
+              {
+                  for (auto &parser : parsed)
+                      sink += parser->find_by_class(class_name).size();
+              });
     }
+    bench(prefix + "process_article x" + to_string(parsed.size()), 0, [&]
+          {
+              for (size_t i = 0; i < parsed.size(); ++i)
+                  sink += process_article(fixture.articles[i].first, *parsed[i], *site.content_xpath).size();
+          });
+    bench(prefix + "parse + process_article x" + to_string(parsed.size()), article_bytes, [&]
+          {
+              for (const auto &article : fixture.articles)
+                  sink += process_article(article.first, *parse_streaming(article.second), *site.content_xpath).size();
+          });
+    bench(prefix + "parse (pooled) + process_article x" + to_string(parsed.size()), article_bytes, [&]
+          {
+              for (const auto &article : fixture.articles)
+                  sink += process_article(article.first, *parse_streaming(article.second, &pool, host), *site.content_xpath).size();
+          });
 
-    // Объединяем все найденные блоки контента в один
-    stringstream ss;
-    for (const string &block : content_blocks)
+    // Текст перед записью в wp_posts: прежний посимвольный slug-цикл (тот же проход по байтам,
+    // что был в insert_wp_post) против normalize_text с каждым доступным набором инструкций
+    vector<string_view> texts;
+    size_t text_bytes = 0;
+    for (size_t i = 0; i < parsed.size(); ++i)
+    {
+        texts.push_back(process_article(fixture.articles[i].first, *parsed[i], *site.content_xpath));
+        text_bytes += texts.back().size();
+    }
+    bench(prefix + "legacy slug loop (text) x" + to_string(texts.size()), text_bytes, [&]
+          {
+              for (string_view text : texts)
+              {
+                  string slug(text);
+                  for (auto &c : slug)
+                  {
+                      if (c == ' ')
+                          c = '-';
+                      else if (!isalnum(c) && c != '-')
+                          c = '\0';
+                  }
+                  slug.erase(remove(slug.begin(), slug.end(), '\0'), slug.end());
+                  sink += slug.size();
+              }
+          });
+    NormalizedText normalized;
+    vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (simd_level() != SimdLevel::Scalar)
+        levels.push_back(SimdLevel::Sse2);
+    if (simd_level() == SimdLevel::Avx2)
+        levels.push_back(SimdLevel::Avx2);
+    size_t normalized_bytes = 0;
+    for (SimdLevel level : levels)
     {
-        ss << block << "\n";
+        bench(prefix + "normalize_text (" + simd_level_name(level) + ") x" + to_string(texts.size()), text_bytes, [&]
+              {
+                  normalized_bytes = 0;
+                  for (string_view text : texts)
+                  {
+                      normalize_text(text, normalized, level);
+                      normalized_bytes += normalized.content.size();
+                  }
+                  sink += normalized_bytes;
+              });
     }
+    if (text_bytes)
+        cout << prefix << "normalized text: " << text_bytes << " -> " << normalized_bytes << " bytes ("
+             << 100 - (long long)(normalized_bytes * 100 / text_bytes) << "% smaller)" << endl;
+    size_t url_bytes = 0;
+    for (const auto &article : fixture.articles)
+        url_bytes += article.first.size();
+    bench(prefix + "make_slug(url) x" + to_string(fixture.articles.size()), url_bytes, [&]
+          {
+              for (const auto &article : fixture.articles)
+                  sink += make_slug(article.first).size();
+          });
+}
+
+// Строки между абзацами статьи и должны ли они остаться после normalize_text: призывы
+// стираются, обычные предложения, начинающиеся с тех же слов, — нет
+const pair<const char *, bool> BOILERPLATE_CASES[] = {
+    {"Read more \xc2\xbb", false},
+    {"Share this:", false},
+    {"SUBSCRIBE NOW!", false},
+    {"Follow us \xe2\x86\x92", false},
+    {"Related: https://example.com/2024/05/other-story", false},
+    {"Advertisement", false},
+    {"Subscribe-based malware spreads through fake invoices.", true},
+    {"Related: the CVE affects every release since 2019.", true},
+    {"Read more about the patch in the vendor advisory.", true},
+    {"Advertisements for fake VPN apps lead to the loader.", true},
+    {"Share prices fell 4% after the breach was disclosed.", true},
+    {"Sharing credentials across sites remains common.", true},
+};
 
-    return ss.str();
+// normalize_text на каждом доступном наборе инструкций должен стирать призывы из
+// BOILERPLATE_CASES и оставлять предложения; расхождение — ошибка --bench
+void check_boilerplate()
+{
+    vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (simd_level() != SimdLevel::Scalar)
+        levels.push_back(SimdLevel::Sse2);
+    if (simd_level() == SimdLevel::Avx2)
+        levels.push_back(SimdLevel::Avx2);
+    const string first = "The first paragraph of the story.", last = "The last paragraph.";
+    NormalizedText normalized;
+    for (const auto &example : BOILERPLATE_CASES)
+    {
+        string expected = example.second ? first + "\n" + example.first + "\n" + last : first + "\n" + last;
+        for (SimdLevel level : levels)
+        {
+            normalize_text(first + "\n" + example.first + "\n" + last, normalized, level);
+            if (normalized.content != expected)
+                throw runtime_error(string("normalize_text (") + simd_level_name(level) + ") " +
+                                    (example.second ? "dropped" : "kept") + " the line \"" + example.first + "\"");
+        }
+    }
+    cout << "Boilerplate filter: " << size(BOILERPLATE_CASES) << " lines x " << levels.size()
+         << " instruction sets" << endl;
 }
 
-// --- Реализация функции save_results ---
-void save_results(const string &output_dir, const string &site_host, const vector<pair<string, string>> &articles)
+// Выражения с интервалами, необязательными символами и экранированными кодами — на них
+// предфильтр RegexSet ошибался; к каждому — адрес, который выражение находит
+const pair<const char *, const char *> REGEX_PREFILTER_CASES[] = {
+    {"/p/[0-9]{1,10}-[a-z]+\\.html$", "https://example.com/p/12345-story.html"},
+    {"[a-z]{2,3}-story", "https://example.com/ab-story"},
+    {"/news/\\d{4}/\\d{2}/", "https://example.com/news/2024/05/title"},
+    {"/20[0-9]{2}/[0-9]{2}/[a-z0-9-]+\\.html$", "https://example.com/2024/05/some-title.html"},
+    {"colou?r-", "https://example.com/color-chart"},
+    {"/ab*c/", "https://example.com/ac/"},
+    {"\\x41BC", "https://example.com/ABC"},
+    {"(a)\\1b", "https://example.com/aab"},
+    {"\\.html?$", "https://example.com/page.htm"},
+};
+
+// Предфильтр RegexSet не должен отвергать адреса, которые находит std::regex_search.
+// Выражения link_filter из конфига и REGEX_PREFILTER_CASES проверяются на ссылках снимков
+// и на адресах примеров; расхождение — ошибка --bench
+void check_regex_prefilter(const ParserConfig &config, const vector<SiteFixture> &fixtures)
 {
-    for (const auto &[url, content] : articles)
+    vector<string> urls;
+    for (const SiteFixture &fixture : fixtures)
     {
-        // Генерируем имя файла на основе URL
-        string file_name = url;
-        replace(file_name.begin(), file_name.end(), '/', '_');
-        file_name = output_dir + "/" + file_name + ".html";
+        HtmlParser listing(fixture.listing);
+        for (const string &link : resolve_links(listing.find_attribute_values(*fixture.site->link_xpath, "href"),
+                                                fixture.listing_url, SiteConfig()))
+            urls.push_back(link);
+        for (const auto &article : fixture.articles)
+            urls.push_back(article.first);
+    }
+    for (const auto &example : REGEX_PREFILTER_CASES)
+        urls.push_back(example.second);
 
-        ofstream ofs(file_name);
-        if (ofs)
+    auto check = [&](const RegexSet &set, const string &name)
+    {
+        for (const string &url : urls)
         {
-            ofs << content;
-            cout << get_current_time() << " Article saved: " << file_name << endl;
+            if (!set.prefilter_agrees(url))
+                throw runtime_error("RegexSet prefilter rejects " + url + ", which " + name + " matches");
         }
-        else
+    };
+    size_t patterns = 0;
+    for (const auto &example : REGEX_PREFILTER_CASES)
+    {
+        RegexSet set({example.first});
+        if (!set.matches(example.second))
+            throw runtime_error(string("RegexSet rejects ") + example.second + ", which " + example.first + " matches");
+        check(set, example.first);
+        patterns++;
+    }
+    for (const SiteConfig &site : config.sites)
+    {
+        if (!site.link_filter.empty())
         {
-            cerr << get_current_time() << " ERROR: Failed to save article: " << file_name << endl;
+            check(site.link_filter, "link_filter of " + site.url);
+            patterns++;
         }
     }
+    cout << "RegexSet prefilter agrees with std::regex: " << patterns << " pattern sets x "
+         << urls.size() << " URLs" << endl;
 }
 
-// --- Реализация функции read_config ---
-ParserConfig read_config(const string &config_file)
+// link_filter с предфильтром против одного std::regex_search: выражения сайта, а если их нет —
+// REGEX_PREFILTER_CASES, на ссылках страницы-списка
+void bench_link_filter(const SiteFixture &fixture)
 {
-    ParserConfig config;
-    ifstream ifs(config_file);
-    if (!ifs)
-    {
-        throw runtime_error("Failed to open config file: " + config_file);
-    }
+    const SiteConfig &site = *fixture.site;
+    vector<string> sources;
+    for (const auto &example : REGEX_PREFILTER_CASES)
+        sources.push_back(example.first);
+    const RegexSet sample(sources);
+    const RegexSet &filter = site.link_filter.empty() ? sample : site.link_filter;
+    string name = url_host(site.url) + (site.link_filter.empty() ? " sample link_filter" : " link_filter");
 
-    Json::Value root;
-    ifs >> root;
+    HtmlParser listing(fixture.listing);
+    vector<string> urls = resolve_links(listing.find_attribute_values(*site.link_xpath, "href"), fixture.listing_url, SiteConfig());
+    if (urls.empty())
+        return;
+    size_t url_bytes = 0;
+    for (const string &url : urls)
+        url_bytes += url.size();
+    volatile size_t sink = 0;
+    bench(name + " regex_search x" + to_string(urls.size()), url_bytes, [&]
+          {
+              for (const string &url : urls)
+                  sink += filter.matches_unfiltered(url);
+          });
+    bench(name + " prefiltered x" + to_string(urls.size()), url_bytes, [&]
+          {
+              for (const string &url : urls)
+                  sink += filter.matches(url);
+          });
+}
 
-    // Чтение конфигурации сайтов
-    for (const auto &site : root["sites"])
+// Страница снимка, в которой ссылки на исходный сайт заменены на адрес локального сервера
+string rewrite_origin(string html, const string &origin_host, const string &local)
+{
+    for (const string &from : {"https://" + origin_host, "http://" + origin_host, "//" + origin_host})
     {
-        SiteConfig site_config;
-        site_config.url = site["url"].asString();
-        site_config.link_pattern = site["link_pattern"].asString();
-        site_config.content_block = site["content_block"].asString();
-        site_config.max_pages = site["max_pages"].asInt();
-
-        config.sites.push_back(site_config);
+        string to = from[0] == '/' ? "//" + local : "http://" + local;
+        for (size_t pos = 0; (pos = html.find(from, pos)) != string::npos; pos += to.size())
+            html.replace(pos, from.size(), to);
     }
+    return html;
+}
 
-    // Чтение общей конфигурации парсера
-    config.output_dir = root["output_dir"].asString();
-    config.request_delay = root["request_delay"].asInt();
-
-    // Чтение конфигурации базы данных
-    const auto &db = root["db"];
-    config.db.host = db["host"].asString();
-    config.db.user = db["user"].asString();
-    config.db.password = db["password"].asString();
-    config.db.database = db["database"].asString();
-    config.db.port = db["port"].asUInt();
-
-    return config;
+// Путь и запрос URL без схемы и хоста
+string url_path(const string &url)
+{
+    size_t start = url.find("://");
+    start = (start == string::npos) ? 0 : start + 3;
+    size_t path = url.find_first_of("/?#", start);
+    return path == string::npos ? "/" : url.substr(path);
 }
 
-// --- Реализация функции ensure_dir_exists ---
-void ensure_dir_exists(const string &dir)
+// process_site целиком: загрузка с локального сервера, конвейер и запись в отдельную БД bench_db
+void bench_end_to_end(ParserConfig config, const vector<SiteFixture> &fixtures, const DbConfig &bench_db)
 {
-    struct stat info;
+    char tmp_template[] = "/tmp/parser-bench-XXXXXX";
+    if (!mkdtemp(tmp_template))
+        throw runtime_error("Failed to create temporary directory");
+    config.output_dir = tmp_template;
+    config.db = bench_db;
+    config.request_delay = 0;
+    config.sites.clear();
 
-    if (stat(dir.c_str(), &info) != 0)
+    vector<unique_ptr<LocalHttpServer>> servers;
+    size_t total_articles = 0, total_bytes = 0;
+    for (const SiteFixture &fixture : fixtures)
     {
-        cerr << get_current_time() << " ERROR: Cannot access " << dir << endl;
-        return;
-    }
+        // Свой сервер на каждый сайт, чтобы относительные ссылки разрешались как на оригинале
+        string host = url_host(fixture.listing_url);
+        auto pages = make_shared<map<string, string>>();
+        servers.push_back(make_unique<LocalHttpServer>(0, [pages](const string &path)
+                                                       {
+            LocalHttpServer::Response r;
+            auto it = pages->find(path);
+            if (it == pages->end())
+                r.status = 404;
+            else
+                r.body = it->second;
+            return r; }));
+        string local = "127.0.0.1:" + to_string(servers.back()->port());
+        (*pages)[url_path(fixture.listing_url)] = rewrite_origin(fixture.listing, host, local);
+        for (const auto &article : fixture.articles)
+        {
+            if (url_host(article.first) != host)
+                continue;
+            (*pages)[url_path(article.first)] = rewrite_origin(article.second, host, local);
+            total_bytes += article.second.size();
+            total_articles++;
+        }
 
-    if (info.st_mode & S_IFDIR)
-    {
-        cout << get_current_time() << " Directory exists: " << dir << endl;
+        SiteConfig site = *fixture.site;
+        site.url = "http://" + local + url_path(fixture.listing_url);
+        // Страницы пагинации тоже берутся с локального сервера (их нет в снимке — ответ 404)
+        site.pagination.url_template = rewrite_origin(site.pagination.url_template, host, local);
+        config.sites.push_back(site);
     }
-    else
+
+    const int RUNS = 3;
+    CurlShare share;
+    HostThrottle throttle(0);
+    CircuitBreaker breaker(config.breaker_threshold, config.breaker_cooldown);
+    Fetcher fetcher(share, throttle, breaker, config.max_parallel, config.max_per_host);
+    AsyncDb db(config.db, config.db_connections);
+    fetcher.attach(&db);
+    ArticleArchive archive(config.output_dir + "/archive", (uint64_t)config.archive_segment_mb << 20,
+                           config.archive_compression);
+    Pipeline pipeline(config, archive);
+    for (int run = 0; run < RUNS; ++run)
     {
-        cerr << get_current_time() << " ERROR: " << dir << " is not a directory" << endl;
+        // Свежий индекс и кэш валидаторов: каждый проход загружает все статьи заново
+        string suffix = "-" + to_string(run);
+        SeenIndex seen(config.output_dir + "/seen_urls" + suffix + ".idx");
+        ValidatorCache validators(config.output_dir + "/validators" + suffix + ".json");
+        auto start = chrono::steady_clock::now();
+        for (const SiteConfig &site : config.sites)
+            process_site(site, config, db, seen, validators, fetcher, pipeline);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(56) << "end-to-end process_site run " + to_string(run + 1) << right << fixed
+             << setprecision(1) << setw(12) << seconds * 1e3 << " ms"
+             << setw(10) << total_articles / seconds << " articles/s"
+             << setw(10) << total_bytes / seconds / 1e6 << " MB/s" << endl;
     }
+    cout << "Bench output left in " << config.output_dir << endl;
 }
 
-// --- Прототипы функций ---
-string process_article(const string &base_url, const string &article_url, const string &content_pattern);
-void save_results(const string &output_dir, const string &site_host, const vector<pair<string, string>> &articles);
-ParserConfig read_config(const string &config_file);
-void ensure_dir_exists(const string &dir);
-void process_site(const SiteConfig &site, const ParserConfig &config, MYSQL *conn); // <--- добавьте этот прототип
-
-void process_site(const SiteConfig &site, const ParserConfig &config, MYSQL *conn)
+void run_benchmarks(const string &config_file, const string &fixtures_dir)
 {
-    cout << get_current_time() << " ===== Starting to process site: " << site.url << " =====" << endl;
+    ParserConfig config = read_config(config_file);
+    logger.set_level(LogLevel::Warning); // вывод журнала искажал бы замеры
+    vector<SiteFixture> fixtures = load_fixtures(config, fixtures_dir);
+    if (fixtures.empty())
+        throw runtime_error("No fixtures found in " + fixtures_dir);
 
-    string main_html = download_html(site.url);
-    HtmlParser main_parser(main_html);
-    if (!main_parser.is_valid())
+    check_regex_prefilter(config, fixtures);
+    check_boilerplate();
+    for (const SiteFixture &fixture : fixtures)
     {
-        cerr << get_current_time() << " ERROR: Failed to parse main page: " << site.url << endl;
-        return;
+        bench_parsing(fixture);
+        bench_link_filter(fixture);
     }
 
-    vector<string> article_links = find_article_links(main_parser, site.link_pattern);
-    cout << get_current_time() << " Total article links found: " << article_links.size() << endl;
-
-    if (article_links.size() > site.max_pages)
+    // Индекс просмотренных URL: проверка всех ссылок страницы-списка
+    char seen_template[] = "/tmp/parser-bench-seen-XXXXXX";
+    int seen_fd = mkstemp(seen_template);
+    if (seen_fd >= 0)
     {
-        cout << get_current_time() << " Limiting articles from " << article_links.size()
-             << " to " << site.max_pages << " (config.max_pages)" << endl;
-        article_links.resize(site.max_pages);
+        close(seen_fd);
+        unlink(seen_template);
+        SeenIndex seen(seen_template);
+        vector<string> links;
+        for (const SiteFixture &fixture : fixtures)
+            for (const auto &article : fixture.articles)
+                links.push_back(article.first);
+        for (size_t i = 0; i < links.size(); i += 2)
+            seen.insert(links[i]);
+        volatile size_t sink = 0;
+        bench("SeenIndex::contains x" + to_string(links.size()), 0, [&]
+              {
+                  for (const string &link : links)
+                      sink += seen.contains(link);
+              });
+        unlink(seen_template);
     }
 
-    vector<pair<string, string>> articles;
-    for (size_t i = 0; i < article_links.size(); ++i)
+    // Запись в БД меняет данные, поэтому end-to-end идёт только с отдельной базой bench_db
+    Json::Value root;
+    ifstream ifs(config_file);
+    ifs >> root;
+    if (!root.isMember("bench_db"))
     {
-        const string &article_url = article_links[i];
-        // Проверка в БД
-        if (url_in_db(conn, article_url)) {
-            cout << get_current_time() << " Already in DB, skipping: " << article_url << endl;
-            continue;
-        }
-        // Добавить в БД
-        insert_url(conn, article_url);
-
-        cout << get_current_time() << " Processing article " << (i + 1) << "/" << article_links.size() << endl;
-        string content = process_article(site.url, article_url, site.content_block);
-        if (!content.empty())
-        {
-            articles.emplace_back(article_url, content);
+        cout << "end-to-end process_site: skipped, no bench_db in " << config_file
+             << " (needs a scratch MariaDB: the run writes posts)" << endl;
+        return;
+    }
+    bench_end_to_end(config, fixtures, read_db_config(root["bench_db"]));
+}
 
-            // --- Вставка в WordPress ---
-            string post_title = article_url;
-            insert_wp_post(conn, post_title, content);
-        }
-        else
+// --archive: без URL — список статей архива (URL и размер), с URL — текст статьи
+int dump_archive(const string &dir, const string &url)
+{
+    try
+    {
+        ArchiveReader reader(dir);
+        if (url.empty())
         {
-            cout << get_current_time() << " WARNING: Empty content for article: " << article_url << endl;
+            reader.scan([](const string &url, const string &content)
+                        {
+                            cout << url << "\t" << content.size() << "\n";
+                            return true; });
+            return 0;
         }
-
-        if (i < article_links.size() - 1)
+        string content;
+        if (!reader.find(url, content))
         {
-            cout << get_current_time() << " Waiting " << config.request_delay << " seconds before next request..." << endl;
-            sleep(config.request_delay);
+            cerr << "Not found in archive: " << url << endl;
+            return 1;
         }
+        cout << content;
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
     }
-
-    size_t start = site.url.find("://") + 3;
-    size_t end = site.url.find("/", start);
-    string host = site.url.substr(start, end - start);
-
-    cout << get_current_time() << " ===== Finished processing site: " << site.url << " =====" << endl;
-    cout << get_current_time() << " Successfully processed " << articles.size() << "/" << article_links.size() << " articles" << endl;
-
-    save_results(config.output_dir, host, articles);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    string mode = argc > 1 && string(argv[1]).compare(0, 2, "--") == 0 ? argv[1] : "";
+    bool daemon = mode == "--daemon";
+    bool fixtures_mode = mode == "--capture" || mode == "--bench";
+    if (mode == "--archive" && (argc == 3 || argc == 4))
+        return dump_archive(argv[2], argc == 4 ? argv[3] : "");
+    bool default_fixtures = argc == 3 && mode == "--bench"; // снимки из репозитория (fixtures/)
+    if (!(argc == 2 && mode.empty()) && !(argc == 3 && daemon) && !(argc == 4 && fixtures_mode) && !default_fixtures)
     {
-        cerr << "Usage: " << argv[0] << " <config_file.json>" << endl;
+        cerr << "Usage: " << argv[0] << " [--daemon] <config_file.json>" << endl
+             << "       " << argv[0] << " --capture <config_file.json> <fixtures_dir>" << endl
+             << "       " << argv[0] << " --bench <config_file.json> [fixtures_dir]" << endl
+             << "       " << argv[0] << " --archive <archive_dir> [url]" << endl;
         return 1;
     }
+    string config_file = argv[fixtures_mode ? 2 : argc - 1];
 
-    cout << get_current_time() << " Initializing parser..." << endl;
-    cout << get_current_time() << " Initializing CURL and libxml2..." << endl;
+    LOG(Info) << "Initializing parser...";
+    LOG(Info) << "Initializing CURL and libxml2...";
     curl_global_init(CURL_GLOBAL_DEFAULT);
     xmlInitParser();
+    mysql_library_init(0, nullptr, nullptr); // до запуска потоков
 
-    try
+    if (daemon)
     {
-        ParserConfig config = read_config(argv[1]);
-        ensure_dir_exists(config.output_dir);
-
-        // --- MariaDB ---
-        MYSQL *conn = init_db(config.db);
+        signal(SIGHUP, handle_signal);
+        signal(SIGTERM, handle_signal);
+        signal(SIGINT, handle_signal);
+    }
 
-        cout << get_current_time() << " Starting to process " << config.sites.size() << " sites" << endl;
-        for (size_t i = 0; i < config.sites.size(); ++i)
+    int status = 0;
+    try
+    {
+        if (mode == "--capture")
+            capture_fixtures(config_file, argv[3]);
+        else if (mode == "--bench")
+            run_benchmarks(config_file, default_fixtures ? "fixtures" : argv[3]);
+        else
         {
-            cout << get_current_time() << " Processing site " << (i + 1) << "/" << config.sites.size() << endl;
-            process_site(config.sites[i], config, conn);
-
-            if (i < config.sites.size() - 1)
-            {
-                cout << get_current_time() << " Waiting " << config.request_delay << " seconds before next site..." << endl;
-                sleep(config.request_delay);
-            }
+            run(config_file, daemon);
+            LOG(Info) << (daemon ? "Daemon stopped" : "All sites processed successfully");
         }
-        mysql_close(conn);
-        cout << get_current_time() << " All sites processed successfully" << endl;
     }
     catch (const exception &e)
     {
-        cerr << get_current_time() << " EXCEPTION: " << e.what() << endl;
+        LOG(Error) << e.what();
+        status = 1; // cron и перезапуск контейнера должны видеть сбой
     }
 
-    cout << get_current_time() << " Cleaning up resources..." << endl;
+    LOG(Info) << "Cleaning up resources...";
+    mysql_library_end();
     xmlCleanupParser();
     curl_global_cleanup();
-    cout << get_current_time() << " Parser finished work" << endl;
+    LOG(Info) << "Parser finished work";
 
-    return 0;
+    return status;
 }
 
 // Подключение к БД использует параметры из config.db, host берётся из config.json
\ No newline at end of file